@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a set of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,79 +17,269 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock and its own LRU list, so CPUs working
+// on different blocks don't contend.
+//
+// Buffers come from a slab cache.  The cache starts with NBUF of
+// them and, on a miss, grows by one until it holds BUFMAX; after
+// that a miss takes the least recently used idle buffer of its
+// bucket, or, if there is none, one from another bucket (see
+// bsteal()).  When memory runs out, ukalloc() calls bshrink() to
+// give idle buffers back, down to NBUF.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "memstat.h"
 
-struct {
+#define NBUCKET 1021  // prime, so runs of blocks spread out
+#define BUFMAX  (PHYSTOP / BUFFRAC / BSIZE)  // most buffers, normally
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  // Linked list of the bucket's buffers, through prev/next.
+  // head is most recently used, tail least.
+  struct buf *head;
+  struct buf *tail;
+  uint nhit;   // lookups that found the block cached
+  uint nmiss;  // ... and that didn't
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // protects nbuf and hand, and is held
+                         // while moving a buffer to another bucket
+  struct slabcache *cache;
+  int nbuf;              // buffers allocated
+  int hand;              // next bucket for bsteal() to look in
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*NBUCKET/2 + blockno) % NBUCKET];
+}
+
+// Put b at the head of bk's list.
+// Caller must hold bk->lock.
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(b->next)
+    b->next->prev = b;
+  else
+    bk->tail = b;
+  bk->head = b;
+}
+
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  else
+    bk->tail = b->prev;
+}
+
+// Allocate a new, idle buffer, unless there are BUFMAX
+// already and force is not set.  Returns 0 if it can't.
+static struct buf*
+bnew(int force)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  if(bcache.nbuf >= BUFMAX && !force){
+    release(&bcache.lock);
+    return 0;
+  }
+  bcache.nbuf++;
+  release(&bcache.lock);
+
+  if((b = slaballoc(bcache.cache)) == 0){
+    acquire(&bcache.lock);
+    bcache.nbuf--;
+    release(&bcache.lock);
+    return 0;
+  }
+  memset(b, 0, sizeof(*b));
+  b->data = b->block;
+  initsleeplock(&b->lock, "buffer");
+  return b;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  bcache.cache = slabcreate("buf", sizeof(struct buf), PG_BUF);
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  // Enough buffers for the log even when memory is short,
+  // dealt out over the buckets: committed blocks stay dirty
+  // in the cache until a checkpoint, up to LOGSIZE of them,
+  // and the operations in progress need some besides.
+  for(i = 0; i < NBUF; i++){
+    if((b = bnew(1)) == 0)
+      panic("binit");
+    blink(&bcache.bucket[i % NBUCKET], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Return the least recently used buffer in bk that holds
+// nothing of value, or 0.  Even if refcnt==0, B_DIRTY indicates
+// a buffer is in use because log.c has modified it but not yet
+// committed it.
+// Caller must hold bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bvictim(struct bucket *bk)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
+  for(b = bk->tail; b; b = b->prev)
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      return b;
+  return 0;
+}
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+// Take an idle buffer out of some bucket other than bk,
+// or return 0.  Holding bcache.lock makes this the only
+// CPU moving buffers between buckets; no CPU ever holds
+// two bucket locks.
+static struct buf*
+bsteal(struct bucket *bk)
+{
+  struct bucket *o;
+  struct buf *b;
+  int i;
+
+  acquire(&bcache.lock);
+  for(i = 0; i < NBUCKET; i++){
+    o = &bcache.bucket[bcache.hand];
+    bcache.hand = (bcache.hand + 1) % NBUCKET;
+    if(o == bk)
+      continue;
+    acquire(&o->lock);
+    if((b = bvictim(o)) != 0){
+      bunlink(o, b);
+      b->flags = 0;  // its block no longer hashes to its bucket
+      release(&o->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
+    release(&o->lock);
   }
+  release(&bcache.lock);
+  return 0;
+}
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Free idle buffers, down to NBUF, because memory is short.
+// Returns the number of pages given back to kalloc.
+int
+bshrink(void)
+{
+  struct bucket *bk;
+  struct buf *b, *freed;
+  int n, want;
+
+  // Give back half of what there is beyond NBUF.
+  acquire(&bcache.lock);
+  want = (bcache.nbuf - NBUF + 1) / 2;
+  release(&bcache.lock);
+
+  freed = 0;
+  n = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET && n < want; bk++){
+    acquire(&bk->lock);
+    while(n < want && (b = bvictim(bk)) != 0){
+      bunlink(bk, b);
+      b->next = freed;
+      freed = b;
+      n++;
     }
+    release(&bk->lock);
+  }
+
+  acquire(&bcache.lock);
+  bcache.nbuf -= n;
+  release(&bcache.lock);
+  for(; freed; freed = b){
+    b = freed->next;
+    slabfree(bcache.cache, freed);
   }
-  panic("bget: no buffers");
+  return slabreap(bcache.cache);
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b, *nb;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+
+  // Is the block already cached?
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno){
+      bk->nhit++;
+      goto found;
+    }
+  bk->nmiss++;
+
+  // Not cached.  Once the cache is full, recycle an unused buffer.
+  // (bcache.nbuf is read without its lock; it's only a hint.)
+  if(bcache.nbuf >= BUFMAX && (b = bvictim(bk)) != 0)
+    goto recycle;
+  release(&bk->lock);
+
+  // Grow the cache, or move a buffer over from another bucket.
+  // If all buffers are in use, grow it anyway.
+  if((nb = bnew(0)) == 0 && (nb = bsteal(bk)) == 0)
+    nb = bnew(1);
+  acquire(&bk->lock);
+  if(nb)
+    blink(bk, nb);  // idle for now, so usable below either way
+  // Someone may have cached the block while bk was unlocked.
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      goto found;
+  if((b = bvictim(bk)) == 0)
+    panic("bget: no buffers");
+
+recycle:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->data = b->block;
+  b->refcnt = 0;
+found:
+  b->refcnt++;
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +295,48 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block, with a read of
+// its contents started if they aren't cached.  Call bwait()
+// before using the data.
+struct buf*
+breadasync(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if((b->flags & B_VALID) == 0)
+    iderwstart(b);
+  return b;
+}
+
+// Start writing b's contents to disk.  Must be locked.
+// Call bwait() before changing or releasing b.
+void
+bwriteasync(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwriteasync");
+  b->flags |= B_DIRTY;
+  iderwstart(b);
+}
+
+// Wait for the disk to finish with locked buf b.
+void
+bwait(struct buf *b)
+{
+  iderwwait(b);
+}
+
+// Wait for the disk to finish with each of the n bufs in bs.
+void
+bwaitall(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderwwait(bs[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +347,26 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Drop a reference to b, whose lock has been released.
+// Move it to the head of its bucket's MRU list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(bk, b);
+    blink(bk, b);
+  }
+  
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,21 +374,56 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Start reading block blockno of dev into the cache, unless it
+// is there already, without waiting for the disk.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID)
+    brelse(b);  // someone read it meanwhile
+  else {
+    b->flags |= B_ASYNC;
+    iderwstart(b);
+  }
+}
+
+// Release b once the read started by breadahead() is done.
+// Called by the disk driver, perhaps from its interrupt handler.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Fill in the buffer cache fields of st.
+void
+bstat(struct memstat *st)
+{
+  struct bucket *bk;
+
+  st->nbuf = bcache.nbuf;
+  st->bufhit = st->bufmiss = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    st->bufhit += bk->nhit;
+    st->bufmiss += bk->nmiss;
   }
-  
-  release(&bcache.lock);
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -2,19 +2,33 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iostat;
+struct memstat;
+struct pcidev;
 struct pipe;
 struct proc;
+struct procmem;
 struct rtcdate;
+struct slabcache;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct text;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bdone(struct buf*);
+struct buf*     breadasync(uint, uint);
+void            breadahead(uint, uint);
+int             bshrink(void);
+void            bstat(struct memstat*);
+void            bwait(struct buf*);
+void            bwaitall(struct buf**, int);
+void            bwriteasync(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -40,9 +54,11 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+int             ishrink(void);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -55,8 +71,13 @@ int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
 void            iderw(struct buf*);
+int             idepresent(int);
+uint            idesize(int);
+void            iderwstart(struct buf*);
+void            iderwwait(struct buf*);
+void            idestat(struct iostat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,9 +86,19 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallocpages(int);
 void            kfree(char*);
+void            kfreepages(char*, int);
 void            kinit1(void*, void*);
+void            kdup(char*);
 void            kinit2(void*, void*);
+void            kmemdump(void);
+void            kmemstat(struct memstat*);
+int             krefs(char*);
+void            kuse(char*, int);
+void            kusepages(char*, int, int);
+char*           kzalloc(void);
+void            kzidle(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -86,11 +117,18 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            flusher(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+int             pciclass(int, int, struct pcidev*);
+int             pcidevice(int, int, struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -98,6 +136,7 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -107,11 +146,15 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+pde_t*          setuvm(struct proc*, pde_t*, uint);
+void            kthread(char*, void(*)(void));
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+int             procmem(uint, int);
+void            reaper(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -122,6 +165,23 @@ void            wakeup(void*);
 void            yield(void);
 char*           getchildren(void);
 void            updateTime(void);
+char*           swapvictim(uint);
+
+// slab.c
+void*           slaballoc(struct slabcache*);
+struct slabcache* slabcreate(char*, uint, int);
+void            slabdump(void);
+void            slabfree(struct slabcache*, void*);
+int             slabreap(struct slabcache*);
+
+// swap.c
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapinit(void);
+int             swapout(void);
+void            swapread(uint, char*);
+char*           ukalloc(void);
+char*           ukzalloc(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -152,12 +212,18 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
-int             argptr(int, char**, int);
+int             argptr(int, char**, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
+// text.c
+struct text*    textget(struct inode*, uint, uint);
+void            textinit(void);
+void            textinval(struct inode*);
+int             textmap(pde_t*, struct text*, uint);
+
 // timer.c
 void            timerinit(void);
 
@@ -172,6 +238,15 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+int             virtiodisk(int);
+void            virtioinit(void);
+int             virtiointr(int);
+uint            virtiosize(void);
+void            virtiorwstart(struct buf*);
+void            virtiorwwait(struct buf*);
+void            virtiostat(struct iostat*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -187,6 +262,14 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             cowfault(pde_t*, uint);
+int             discarduvm(pde_t*, uint, uint);
+int             mapcow(pde_t*, uint, char*);
+int             pagefault(pde_t*, uint, int);
+int             pagein(pde_t*, uint, uint, int);
+int             swapcount(pde_t*, uint);
+char*           swapscan(pde_t*, uint, uint*, int*, uint);
+void            uvmstat(pde_t*, struct procmem*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
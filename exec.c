@@ -7,15 +7,69 @@
 #include "x86.h"
 #include "elf.h"
 
+#define ULIBPATH "/ulib"  // shared runtime library, see Makefile
+
+// Load the ELF image in ip into pgdir.  Its segments must lie
+// in [base, limit).  Segment file contents come copy-on-write
+// from the text cache when they can.  Caller must hold ip->lock.
+// Returns the end of the image and sets *entry (if not 0),
+// or returns 0 on error.
+static uint
+loadelf(pde_t *pgdir, struct inode *ip, uint base, uint limit, uint *entry)
+{
+  int i, off;
+  uint sz;
+  struct elfhdr elf;
+  struct proghdr ph;
+  struct text *t;
+
+  // Check ELF header
+  if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
+    return 0;
+  if(elf.magic != ELF_MAGIC)
+    return 0;
+
+  sz = base;
+  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
+    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
+      return 0;
+    if(ph.type != ELF_PROG_LOAD)
+      continue;
+    if(ph.memsz < ph.filesz)
+      return 0;
+    if(ph.vaddr + ph.memsz < ph.vaddr)
+      return 0;
+    if(ph.vaddr < base || ph.vaddr + ph.memsz > limit)
+      return 0;
+    if(ph.vaddr % PGSIZE != 0)
+      return 0;
+    t = 0;
+    if(ph.vaddr >= PGROUNDUP(sz) && ph.filesz > 0){
+      if(ph.vaddr > sz && (sz = allocuvm(pgdir, sz, ph.vaddr)) == 0)
+        return 0;
+      // Map the file part copy-on-write from the text cache.
+      if((t = textget(ip, ph.off, ph.filesz)) != 0){
+        if(textmap(pgdir, t, ph.vaddr) < 0)
+          return 0;
+        sz = ph.vaddr + ph.filesz;
+      }
+    }
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+      return 0;
+    if(t == 0 && loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+      return 0;
+  }
+  if(entry)
+    *entry = elf.entry;
+  return sz;
+}
+
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
-  struct elfhdr elf;
+  uint argc, sz, sp, entry, ustack[3+MAXARG+1];
   struct inode *ip;
-  struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -29,34 +83,23 @@ exec(char *path, char **argv)
   ilock(ip);
   pgdir = 0;
 
-  // Check ELF header
-  if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
+  if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  if((pgdir = setupkvm()) == 0)
+  // Load program into memory, leaving room below ULIBBASE
+  // for the stack.
+  if((sz = loadelf(pgdir, ip, 0, ULIBBASE - 2*PGSIZE, &entry)) == 0)
     goto bad;
+  iunlockput(ip);
 
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+  // Map the shared runtime library at ULIBBASE.  Without one,
+  // only statically linked programs will run.
+  if((ip = namei(ULIBPATH)) != 0){
+    ilock(ip);
+    if(loadelf(pgdir, ip, ULIBBASE, KERNBASE, 0) == 0)
       goto bad;
+    iunlockput(ip);
   }
-  iunlockput(ip);
   end_op();
   ip = 0;
 
@@ -94,10 +137,8 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
+  oldpgdir = setuvm(curproc, pgdir, sz);
+  curproc->tf->eip = entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
@@ -14,15 +14,21 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // icache list
+  struct inode *idleprev; // icache idle list, if ref is 0
+  struct inode *idlenext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // block after the last one readi() read
+  uint rawin;         // read-ahead window, in blocks
+  uint raend;         // block after the last one read ahead
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+NLEVEL];
 };
 
 // table mapping major device number to
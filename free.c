@@ -0,0 +1,35 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+// Print how physical memory is used, in KB.
+
+char *usename[NPGUSE] = {
+  [PG_KERNEL] "kernel",
+  [PG_KSTACK] "kstack",
+  [PG_PGTBL]  "pgtbl",
+  [PG_USER]   "user",
+  [PG_SLAB]   "slab",
+  [PG_TEXT]   "text",
+  [PG_BUF]    "buf",
+};
+
+int
+main(void)
+{
+  struct memstat st;
+  int u;
+
+  if(memstat(&st) < 0){
+    printf(2, "free: memstat failed\n");
+    exit();
+  }
+  printf(1, "total %d KB, used %d KB, free %d KB (kernel image %d KB)\n",
+         st.total*4, (st.total - st.free)*4, st.free*4, st.kernel*4);
+  for(u = 0; u < NPGUSE; u++)
+    printf(1, "  %s\t%d KB\n", usename[u], st.use[u]*4);
+  printf(1, "block cache: %d buffers, %d hits, %d misses\n",
+         st.nbuf, st.bufhit, st.bufmiss);
+  exit();
+}
@@ -20,8 +20,11 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "memstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define RAMIN 4   // first read-ahead window, in blocks
+#define RAMAX 32  // largest read-ahead window
 static void itrunc(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
@@ -119,18 +122,17 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref reaches zero stays cached, idle,
+//   until it is reclaimed (see below).
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -154,35 +156,97 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// Cache entries come from a slab cache and are kept on
+// icache.list.  Idle entries (ref 0) are also kept on the LRU
+// list icache.idle, so that reopening a file finds it, read-ahead
+// state and all, without reading the disk.  At most NIDLEINODE
+// are kept; beyond that, and when memory is short (ishrink()),
+// the least recently used are freed.  The icache.lock spin-lock
+// protects the lists.  Since ip->ref decides when an entry is
+// freed, and ip->dev and ip->inum indicate which i-node an entry
+// holds, one must hold icache.lock while using any of those
+// fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
-// read or write that inode's ip->valid, ip->size, ip->type, &c.
+// dev, inum, next, and the idle links.  One must hold ip->lock in
+// order to read or write that inode's ip->valid, ip->size,
+// ip->type, &c.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache *cache;
+  struct inode *list;      // all entries
+  struct inode *idle;      // entries with ref 0, most recent first
+  struct inode *idletail;  // ... least recent
+  int nidle;
 } icache;
 
+// Put idle ip at the head of icache.idle.
+// Caller must hold icache.lock.
+static void
+idlelink(struct inode *ip)
+{
+  ip->idleprev = 0;
+  ip->idlenext = icache.idle;
+  if(ip->idlenext)
+    ip->idlenext->idleprev = ip;
+  else
+    icache.idletail = ip;
+  icache.idle = ip;
+  icache.nidle++;
+}
+
+// Take ip off icache.idle.
+// Caller must hold icache.lock.
+static void
+idleunlink(struct inode *ip)
+{
+  if(ip->idleprev)
+    ip->idleprev->idlenext = ip->idlenext;
+  else
+    icache.idle = ip->idlenext;
+  if(ip->idlenext)
+    ip->idlenext->idleprev = ip->idleprev;
+  else
+    icache.idletail = ip->idleprev;
+  icache.nidle--;
+}
+
+// Take idle ip out of the cache altogether; the caller
+// frees it or reuses it.
+// Caller must hold icache.lock.
+static void
+ievict(struct inode *ip)
+{
+  struct inode **pp;
+
+  idleunlink(ip);
+  for(pp = &icache.list; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+}
+
+// Called from main() before the first process runs,
+// since userinit() looks up "/".
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = slabcreate("inode", sizeof(struct inode), PG_SLAB);
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  if(sb.magic != FSMAGIC)
+    panic("iinit: not a revision 2 file system");
+  if(sb.size > idesize(dev))
+    panic("iinit: file system larger than disk");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -241,31 +305,38 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.list; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        idleunlink(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate a new inode cache entry, or if memory is
+  // short, recycle the least recently used idle one.
+  if((ip = slaballoc(icache.cache)) == 0){
+    if((ip = icache.idletail) == 0)
+      panic("iget: no inodes");
+    ievict(ip);
+  }
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = 0;
+  ip->rawin = 0;
+  ip->raend = 0;
+  ip->next = icache.list;
+  icache.list = ip;
   release(&icache.lock);
 
   return ip;
@@ -322,8 +393,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry
+// becomes idle.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,6 +402,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode *victim;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -347,8 +420,45 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&icache.lock);
+    return;
+  }
+  // Keep it for the next open, unless it was just freed
+  // on disk; make room by freeing the least recently used.
+  idlelink(ip);
+  victim = 0;
+  if(!ip->valid)
+    victim = ip;
+  else if(icache.nidle > NIDLEINODE)
+    victim = icache.idletail;
+  if(victim)
+    ievict(victim);
   release(&icache.lock);
+  if(victim)
+    slabfree(icache.cache, victim);
+}
+
+// Free all idle inode cache entries because memory is short.
+// Returns the number of pages given back to kalloc.
+int
+ishrink(void)
+{
+  struct inode *ip, *freed;
+
+  freed = 0;
+  acquire(&icache.lock);
+  while((ip = icache.idletail) != 0){
+    ievict(ip);
+    ip->next = freed;
+    freed = ip;
+  }
+  release(&icache.lock);
+  for(; freed; freed = ip){
+    ip = freed->next;
+    slabfree(icache.cache, freed);
+  }
+  return slabreap(icache.cache);
 }
 
 // Common idiom: unlock, then put.
@@ -365,15 +475,19 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the next NINDIRECT^2
+// in the blocks listed in block ip->addrs[NDIRECT+1], and
+// the last NINDIRECT^3 a level further down from
+// ip->addrs[NDIRECT+2].
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, n;
   struct buf *bp;
+  int level;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
@@ -382,21 +496,84 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the tree of indirect blocks holding bn.
+  n = NINDIRECT;  // blocks in the tree
+  for(level = 1; bn >= n; level++){
+    if(level == NLEVEL)
+      panic("bmap: out of range");
+    bn -= n;
+    n *= NINDIRECT;
+  }
+
+  // Walk down it, allocating indirect blocks if necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = balloc(ip->dev);
+  for(; level > 0; level--){
+    n /= NINDIRECT;  // blocks under each entry of this one
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn/n]) == 0){
+      a[bn/n] = addr = balloc(ip->dev);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    bn %= n;
+  }
+  return addr;
+}
+
+// A truncation in progress: how many more bitmap blocks the
+// current transaction may change, and the last one it did.
+struct trunc {
+  int left;
+  uint bblock;
+};
+
+// Free block b, unless that would change one bitmap block
+// too many for the transaction.  Returns 1 if it was freed.
+static int
+tfree(uint dev, uint b, struct trunc *t)
+{
+  if(BBLOCK(b, sb) != t->bblock){
+    if(t->left == 0)
+      return 0;
+    t->left--;
+    t->bblock = BBLOCK(b, sb);
   }
+  bfree(dev, b);
+  return 1;
+}
 
-  panic("bmap: out of range");
+// Free the indirect block addr, with depth levels of indirect
+// blocks below it, and the data blocks they list.  Returns 0 if
+// the transaction ran out of room first, having cleared the
+// entries of what it did free, so that the next one can go on.
+static int
+itrunctree(uint dev, uint addr, int depth, struct trunc *t)
+{
+  struct buf *bp;
+  uint *a;
+  int j, cleared;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  cleared = 0;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(!(depth > 1 ? itrunctree(dev, a[j], depth-1, t) : tfree(dev, a[j], t)))
+      break;
+    a[j] = 0;
+    cleared = 1;
+  }
+  if(j == NINDIRECT && tfree(dev, addr, t)){
+    brelse(bp);
+    return 1;
+  }
+  if(cleared)
+    log_write(bp);
+  brelse(bp);
+  return 0;
 }
 
 // Truncate inode (discard contents).
@@ -404,30 +581,38 @@ bmap(struct inode *ip, uint bn)
 // to it (no directory entries referring to it)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
+// A large file is freed over several transactions.
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  struct trunc t;
+  int i, depth, done;
+
+  textinval(ip);
+  for(;;){
+    // Leave room in the log for what the caller wrote in this
+    // transaction, the inode and a path of indirect blocks.
+    t.left = MAXOPBLOCKS/2 - 1 - NLEVEL;
+    t.bblock = 0;
+    done = 1;
+    for(i = 0; i < NDIRECT+NLEVEL && done; i++){
+      if(ip->addrs[i] == 0)
+        continue;
+      depth = i < NDIRECT ? 0 : i - NDIRECT + 1;
+      if(depth == 0 ? tfree(ip->dev, ip->addrs[i], &t) :
+         itrunctree(ip->dev, ip->addrs[i], depth, &t))
+        ip->addrs[i] = 0;
+      else
+        done = 0;
     }
-  }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    if(done)
+      break;
+    // Commit what is freed so far and go on in a new
+    // transaction.  No one else can be waiting for ip,
+    // since it has no links or other references.
+    iupdate(ip);
+    end_op();
+    begin_op();
   }
 
   ip->size = 0;
@@ -446,6 +631,36 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading the blocks after the first of a read of
+// [off, off+n) from ip, so the disk works on them while readi()
+// waits for the first.  If ip is being read sequentially, also
+// read ahead of the request, by a window that doubles with
+// each sequential read, up to RAMAX blocks.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, first, last, end;
+
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  if(off == 0 || first == ip->ranext || first + 1 == ip->ranext)
+    ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  end = min(last + 1 + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  bn = first + 1;
+  if(bn < ip->raend)
+    bn = ip->raend;  // already started
+  for(; bn < end; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  if(end > ip->raend)
+    ip->raend = end;
+  ip->ranext = last + 1;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -465,6 +680,8 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -495,6 +712,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  textinval(ip);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -19,11 +19,22 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint magic;        // FSMAGIC
+  uint stripe;       // Blocks per chunk if striped over two disks, else 0
 };
 
-#define NDIRECT 12
+// Revision 2: inodes with doubly- and triply-indirect blocks.
+// Older images have 0 in place of magic.
+#define FSMAGIC 0x78763602
+
+// A file's blocks: NDIRECT listed in the inode, then NINDIRECT
+// listed in an indirect block, then NINDIRECT^2 under a doubly-
+// indirect block, then NINDIRECT^3 under a triply-indirect one.
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NLEVEL 3  // most levels of indirect blocks
+#define MAXFILE (NDIRECT + NINDIRECT + NINDIRECT*NINDIRECT + \
+                 NINDIRECT*NINDIRECT*NINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +43,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+NLEVEL];   // Data block addresses
 };
 
 // Inodes per block.
@@ -1,4 +1,22 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+//
+// Disks 0 and 1 are the master and slave of the primary channel,
+// disk 2 the master of the secondary channel.  Each channel runs
+// one command at a time and has its own queue, so disks on
+// different channels work concurrently.
+//
+// A file system made by mkfs -s (device ROOTDEV) is striped
+// across disks 1 and 2, RAID-0 style: chunks of STRIPE blocks go
+// alternately to each disk (see idemap()), so a large sequential
+// transfer keeps both channels busy.  Its superblock, on disk 1
+// either way, says so.
+//
+// If the PCI IDE controller can do bus-master DMA (PIIX, as
+// QEMU emulates), the disk transfers the blocks to and from
+// memory itself, following a table of physical regions (PRD
+// table) built from the bufs' data, and interrupts once at the
+// end.  Otherwise, or if a DMA transfer fails, the driver falls
+// back to PIO, copying each sector through the data port.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +30,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -24,145 +44,574 @@
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_CMD_SETMULT 0xc6
+#define IDE_CMD_IDENTIFY 0xec
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-static struct spinlock idelock;
-static struct buf *idequeue;
+// Task file registers, from a channel's base port.
+#define IDE_DATA      0
+#define IDE_NSECT     2
+#define IDE_LBA0      3
+#define IDE_LBA1      4
+#define IDE_LBA2      5
+#define IDE_SELECT    6
+#define IDE_STATUS    7     // reading; command, writing
 
-static int havedisk1;
-static void idestart(struct buf*);
+// Bus-master registers of a channel, at its bm port.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_CMD_START  0x01  // start the transfer
+#define BM_CMD_READ   0x08  // transfer is from disk to memory
+#define BM_ST_ERR     0x02  // transfer failed
+#define BM_ST_INTR    0x04  // disk interrupted
+#define PRD_EOT       0x8000  // last entry of the table
+
+#define IDE_NPRD     64  // most blocks per DMA command
+
+#define IDE_MULT     16  // sectors per interrupt for RDMUL/WRMUL
+#define IDE_DEADLINE 50  // ticks a request may wait before it goes first
+#define IDE_RETRIES   3  // times a failed read is retried
+
+#define NDISK        3
+
+// Physical region descriptor.  The table must not cross
+// a 64KB boundary, so it is aligned to its size.
+struct prd {
+  uint addr;
+  ushort count;   // bytes, 0 means 64KB
+  ushort flags;
+};
+
+// queue points to the buf now being read/written to the disk,
+// the first of busy bufs of consecutive blocks that one disk
+// command is transferring.  The bufs after those are kept in
+// C-SCAN order: ascending block numbers from where the disk head
+// is now, wrapping around to the lowest, so the head sweeps across
+// the disks in one direction.  A request that has waited more
+// than IDE_DEADLINE ticks goes next regardless.
+// You must hold lock while manipulating queue.
+struct channel {
+  struct spinlock lock;
+  ushort base;            // task file registers
+  ushort ctl;             // device control register
+  ushort bm;              // bus-master registers, 0 if no DMA
+  struct buf *queue;
+  int busy;               // bufs in the command in progress
+  int retries;            // times that command has failed
+  uint pos;               // key of the block after that command
+  struct iostat stats;
+  struct prd prdt[IDE_NPRD] __attribute__((aligned(IDE_NPRD*sizeof(struct prd))));
+};
+
+static struct channel channel[2] = {
+  { .base = 0x1f0, .ctl = 0x3f6 },  // IRQ_IDE
+  { .base = 0x170, .ctl = 0x376 },  // IRQ_IDE+1
+};
+
+static int havedisk[NDISK];
+static int idemult[NDISK];  // sectors per RDMUL/WRMUL, for each disk
+static uint idenblock[NDISK]; // size of each disk, in blocks
+static int idestripe;       // is ROOTDEV striped across disks 1 and 2?
+static void idestart(struct channel*, struct buf*);
+
+// Which disk holds the block of b, and where on it.
+static int
+idemap(struct buf *b, uint *blockno)
+{
+  uint chunk;
+
+  if(b->dev == ROOTDEV && idestripe){
+    chunk = b->blockno / STRIPE;
+    *blockno = chunk/2*STRIPE + b->blockno%STRIPE;
+    return chunk%2 ? 2 : 1;
+  }
+  *blockno = b->blockno;
+  return b->dev;
+}
+
+static struct channel*
+idechannel(struct buf *b)
+{
+  uint blockno;
+
+  return &channel[idemap(b, &blockno) / 2];
+}
+
+// Position of b in the sweep across the channel's disks.
+static uint
+idekey(struct buf *b)
+{
+  uint blockno;
+  int disk;
+
+  disk = idemap(b, &blockno);
+  return ((disk&1) << 28) | blockno;
+}
 
 // Wait for IDE disk to become ready.
 static int
-idewait(int checkerr)
+idewait(struct channel *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->base + IDE_STATUS)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Is there a disk in place of disk?
+static int
+ideprobe(int disk)
+{
+  struct channel *c;
+  int i, r;
+
+  c = &channel[disk/2];
+  outb(c->base + IDE_SELECT, 0xe0 | ((disk&1)<<4));
+  for(i=0; i<1000; i++){
+    r = inb(c->base + IDE_STATUS);
+    if(r != 0 && r != 0xff)  // 0xff: no drives on the channel
+      return 1;
+  }
+  return 0;
+}
+
+// Have disk transfer IDE_MULT sectors per interrupt with
+// RDMUL/WRMUL, so a merged request takes a single interrupt.
+static void
+idesetmult(int disk)
+{
+  struct channel *c;
+
+  c = &channel[disk/2];
+  outb(c->base + IDE_SELECT, 0xe0 | ((disk&1)<<4));
+  idewait(c, 0);
+  outb(c->base + IDE_NSECT, IDE_MULT);
+  outb(c->base + IDE_STATUS, IDE_CMD_SETMULT);
+  idemult[disk] = idewait(c, 1) < 0 ? 0 : IDE_MULT;
+}
+
+// Ask disk for its size.  Sector numbers have 28 bits,
+// so a disk larger than 128GB is used up to there.
+// Returns -1 if it is not an ATA disk: an ATAPI device (a
+// CD-ROM, say) has a signature in LBA1/LBA2 and aborts
+// IDENTIFY.
+static int
+ideidentify(int disk)
+{
+  struct channel *c;
+  uint id[SECTOR_SIZE/4];
+
+  c = &channel[disk/2];
+  idenblock[disk] = (1<<28) / (BSIZE/SECTOR_SIZE);  // if it won't say
+  outb(c->base + IDE_SELECT, 0xe0 | ((disk&1)<<4));
+  if(inb(c->base + IDE_LBA1) == 0x14 && inb(c->base + IDE_LBA2) == 0xeb)
+    return -1;
+  idewait(c, 0);
+  outb(c->base + IDE_STATUS, IDE_CMD_IDENTIFY);
+  if(idewait(c, 1) < 0)
+    return -1;
+  insl(c->base + IDE_DATA, id, SECTOR_SIZE/4);
+  if(id[30] != 0)  // words 60-61: sectors addressable with LBA28
+    idenblock[disk] = id[30] / (BSIZE/SECTOR_SIZE);
+  return 0;
+}
+
+// Read the superblock of the file system on disk 1, by polling,
+// and return its stripe field: nonzero if it is striped across
+// disks 1 and 2.  Block 1 is on disk 1 either way.
+static uint
+idesbstripe(void)
+{
+  struct channel *c;
+  uint sect[SECTOR_SIZE/4];
+  struct superblock *sb;
+  int sector;
+
+  c = &channel[0];
+  sector = 1 * (BSIZE/SECTOR_SIZE);
+  outb(c->base + IDE_SELECT, 0xe0 | (1<<4));
+  idewait(c, 0);
+  outb(c->base + IDE_NSECT, 1);
+  outb(c->base + IDE_LBA0, sector & 0xff);
+  outb(c->base + IDE_LBA1, (sector >> 8) & 0xff);
+  outb(c->base + IDE_LBA2, (sector >> 16) & 0xff);
+  outb(c->base + IDE_STATUS, IDE_CMD_READ);
+  if(idewait(c, 1) < 0)
+    return 0;
+  insl(c->base + IDE_DATA, sect, SECTOR_SIZE/4);
+  sb = (struct superblock*)sect;
+  return sb->magic == FSMAGIC ? sb->stripe : 0;
+}
+
 void
 ideinit(void)
 {
-  int i;
+  struct pcidev pci;
+  uint stripe;
+  int d;
 
-  initlock(&idelock, "ide");
+  initlock(&channel[0].lock, "ide");
+  initlock(&channel[1].lock, "ide1");
   ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+  idewait(&channel[0], 0);
 
-  // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1<<4));
-  for(i=0; i<1000; i++){
-    if(inb(0x1f7) != 0){
-      havedisk1 = 1;
-      break;
+  havedisk[0] = 1;
+  havedisk[1] = ideprobe(1);
+  havedisk[2] = ideprobe(2);
+
+  // Only ATA disks will do as disks 1 and 2.
+  for(d = 0; d < NDISK; d++)
+    if(havedisk[d]){
+      if(ideidentify(d) < 0 && d > 0)
+        havedisk[d] = 0;
+      else
+        idesetmult(d);
+    }
+  stripe = havedisk[1] ? idesbstripe() : 0;
+  if(havedisk[2])
+    ioapicenable(IRQ_IDE+1, ncpu - 1);
+
+  // Use DMA if the IDE controller is a bus master (prog if
+  // bit 7) with its registers in I/O space (BAR4).
+  if(pciclass(0x01, 0x01, &pci) && (pci.progif & 0x80) && pci.bar[4] &&
+     (pciread(&pci, PCI_BAR0 + 4*4) & 1)){
+    channel[0].bm = pci.bar[4];
+    channel[1].bm = pci.bar[4] + 8;
+  }
+
+  if(stripe){
+    if(stripe != STRIPE)
+      panic("ideinit: file system has another stripe size");
+    if(!havedisk[2])
+      panic("ideinit: striped file system without disk 2");
+    idestripe = 1;
+    cprintf("ide: disk %d striped across disks 1 and 2\n", ROOTDEV);
+  }
+
+  // A virtio disk, if QEMU has one, takes the place of disk 1.
+  virtioinit();
+}
+
+// Start a DMA transfer of the n bufs from b on in c's queue,
+// starting at sector.  Caller must hold c->lock.
+static void
+idedmastart(struct channel *c, struct buf *b, int n, int disk, int sector)
+{
+  struct buf *q;
+  struct prd *p;
+  uint pa;
+  int nsect;
+
+  nsect = n * (BSIZE/SECTOR_SIZE);
+
+  // One region per buf, joined with the previous one
+  // if the data happens to follow it in memory.
+  p = c->prdt - 1;
+  for(q = b; n-- > 0; q = q->qnext){
+    pa = V2P(q->data);
+    if(p >= c->prdt && p->addr + p->count == pa && (pa & 0xffff) != 0)
+      p->count += BSIZE;
+    else {
+      p++;
+      p->addr = pa;
+      p->count = BSIZE;
+      p->flags = 0;
     }
   }
+  p->flags = PRD_EOT;
+
+  outl(c->bm + BM_PRDT, V2P(c->prdt));
+  outb(c->bm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+  outb(c->bm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);  // clear them
 
-  // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0<<4));
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base + IDE_NSECT, nsect);  // number of sectors
+  outb(c->base + IDE_LBA0, sector & 0xff);
+  outb(c->base + IDE_LBA1, (sector >> 8) & 0xff);
+  outb(c->base + IDE_LBA2, (sector >> 16) & 0xff);
+  outb(c->base + IDE_SELECT, 0xe0 | ((disk&1)<<4) | ((sector>>24)&0x0f));
+  outb(c->base + IDE_STATUS, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+  outb(c->bm + BM_CMD, inb(c->bm + BM_CMD) | BM_CMD_START);
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b, merged with the bufs after it in
+// c's queue that hold the following blocks of the same disk,
+// if they go the same way.  Caller must hold c->lock.
 static void
-idestart(struct buf *b)
+idestart(struct channel *c, struct buf *b)
 {
+  struct buf *q;
+  uint blockno, qblockno;
+  int n, maxn, disk;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
+  disk = idemap(b, &blockno);
   int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int sector = blockno * sector_per_block;
 
   if (sector_per_block > 7) panic("idestart");
 
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  // Without multiple mode the disk interrupts for every sector,
+  // so only a single sector is transferred per PIO command.
+  maxn = c->bm ? IDE_NPRD : idemult[disk] / sector_per_block;
+  n = 1;
+  for(q = b->qnext; q && n < maxn; q = q->qnext, n++)
+    if(idemap(q, &qblockno) != disk || qblockno != blockno + n ||
+       (q->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  c->busy = n;
+  c->pos = idekey(b) + n;
+  c->stats.ncmd++;
+  c->stats.nmerged += n - 1;
+
+  if(c->bm){
+    idedmastart(c, b, n, disk, sector);
+    return;
+  }
+
+  int nsect = n * sector_per_block;
+  int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base + IDE_NSECT, nsect);  // number of sectors
+  outb(c->base + IDE_LBA0, sector & 0xff);
+  outb(c->base + IDE_LBA1, (sector >> 8) & 0xff);
+  outb(c->base + IDE_LBA2, (sector >> 16) & 0xff);
+  outb(c->base + IDE_SELECT, 0xe0 | ((disk&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outb(c->base + IDE_STATUS, write_cmd);
+    for(q = b; n-- > 0; q = q->qnext)
+      outsl(c->base + IDE_DATA, q->data, BSIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->base + IDE_STATUS, read_cmd);
+  }
+}
+
+// Pick the request to start next, the head of c's queue:
+// the first in C-SCAN order, unless one has waited too long.
+// Caller must hold c->lock.
+static void
+idenext(struct channel *c)
+{
+  struct buf **pp, **oldest;
+
+  oldest = 0;
+  for(pp = &c->queue; *pp; pp = &(*pp)->qnext)
+    if(oldest == 0 || (*pp)->qtime < (*oldest)->qtime)
+      oldest = pp;
+  if(oldest && oldest != &c->queue && ticks - (*oldest)->qtime > IDE_DEADLINE){
+    struct buf *b = *oldest;
+    *oldest = b->qnext;
+    b->qnext = c->queue;
+    c->queue = b;
+    c->stats.ndeadline++;
   }
 }
 
-// Interrupt handler.
+// Interrupt handler for channel ch.
 void
-ideintr(void)
+ideintr(int ch)
 {
+  struct channel *c;
   struct buf *b;
+  int n;
+  uchar st;
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  c = &channel[ch];
 
-  if((b = idequeue) == 0){
-    release(&idelock);
+  // First queued buffers are the active request.
+  acquire(&c->lock);
+
+  if((b = c->queue) == 0){
+    release(&c->lock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(c->bm){
+    // Stop the DMA engine; the data is in place unless it failed.
+    outb(c->bm + BM_CMD, inb(c->bm + BM_CMD) & ~BM_CMD_START);
+    st = inb(c->bm + BM_STATUS);
+    outb(c->bm + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    if(idewait(c, 1) < 0 || (st & BM_ST_ERR)){
+      cprintf("ide: dma failed, using pio\n");
+      c->bm = 0;
+      idestart(c, b);
+      release(&c->lock);
+      return;
+    }
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Read data if needed.  A read that fails is tried again;
+  // the bufs must not be marked valid with whatever they hold.
+  if(!c->bm && !(b->flags & B_DIRTY) && idewait(c, 1) < 0){
+    if(++c->retries > IDE_RETRIES)
+      panic("ide: read error");
+    idestart(c, b);
+    release(&c->lock);
+    return;
+  }
+  c->retries = 0;
+  for(n = c->busy; n > 0; n--){
+    b = c->queue;
+    c->queue = b->qnext;
+    c->stats.depth--;
+    if(!c->bm && !(b->flags & B_DIRTY))
+      insl(c->base + IDE_DATA, b->data, BSIZE/4);
+
+    // Wake process waiting for this buf,
+    // or release it if no process is.
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_QUEUED);
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bdone(b);
+    } else
+      wakeup(b);
+  }
+  c->busy = 0;
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(c->queue != 0){
+    idenext(c);
+    idestart(c, c->queue);
+  }
 
-  release(&idelock);
+  release(&c->lock);
+}
+
+// Copy the request counters, the virtio disk's included, to st.
+void
+idestat(struct iostat *st)
+{
+  struct channel *c;
+
+  memset(st, 0, sizeof(*st));
+  for(c = channel; c < &channel[2]; c++){
+    acquire(&c->lock);
+    st->nreq += c->stats.nreq;
+    st->ncmd += c->stats.ncmd;
+    st->nmerged += c->stats.nmerged;
+    st->ndeadline += c->stats.ndeadline;
+    st->depth += c->stats.depth;
+    if(c->stats.maxdepth > st->maxdepth)
+      st->maxdepth = c->stats.maxdepth;
+    release(&c->lock);
+  }
+  virtiostat(st);
+}
+
+// Is there a disk for device dev?
+int
+idepresent(int dev)
+{
+  return dev == 0 || havedisk[1] || virtiodisk(dev);
+}
+
+// Blocks on device dev.
+uint
+idesize(int dev)
+{
+  uint n1, n2;
+
+  if(virtiodisk(dev))
+    return virtiosize();
+  if(dev == ROOTDEV && idestripe){
+    // Striped: up to the first block that falls off the end of
+    // disk 1 (even chunks) or disk 2 (odd chunks).  Disk 1 may
+    // hold one chunk more than disk 2.
+    n1 = 2*(idenblock[1]/STRIPE)*STRIPE + idenblock[1]%STRIPE;
+    n2 = (2*(idenblock[2]/STRIPE) + 1)*STRIPE + idenblock[2]%STRIPE;
+    return n1 < n2 ? n1 : n2;
+  }
+  if(!idepresent(dev))
+    return 0;
+  return idenblock[dev];
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue buf for the disk and return without waiting.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// B_QUEUED is set until then; if B_ASYNC is set too, ideintr()
+// releases buf when it is done.
 void
-iderw(struct buf *b)
+iderwstart(struct buf *b)
 {
+  struct channel *c;
   struct buf **pp;
+  uint key;
+  int i;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
+  if(b->flags & B_QUEUED)
+    panic("iderw: already queued");
+  if(virtiodisk(b->dev)){
+    virtiorwstart(b);
+    return;
+  }
+  if(b->dev != 0 && !havedisk[1])
     panic("iderw: ide disk 1 not present");
+  if(b->blockno >= idesize(b->dev))
+    panic("iderw: block out of range");
 
-  acquire(&idelock);  //DOC:acquire-lock
+  c = idechannel(b);
+  acquire(&c->lock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+  // Insert b into the queue, after the bufs being transferred,
+  // in C-SCAN order.
+  b->flags |= B_QUEUED;
+  b->qtime = ticks;
+  key = idekey(b) - c->pos;
+  for(pp=&c->queue, i=0; *pp; pp=&(*pp)->qnext, i++)  //DOC:insert-queue
+    if(i >= c->busy && idekey(*pp) - c->pos > key)
+      break;
+  b->qnext = *pp;
   *pp = b;
+  c->stats.nreq++;
+  if(++c->stats.depth > c->stats.maxdepth)
+    c->stats.maxdepth = c->stats.depth;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(c->queue == b && c->busy == 0)
+    idestart(c, b);
 
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
-  }
+  release(&c->lock);
+}
 
+// Wait for the request for buf, if any, to finish.
+void
+iderwwait(struct buf *b)
+{
+  struct channel *c;
+
+  if(virtiodisk(b->dev)){
+    virtiorwwait(b);
+    return;
+  }
+  c = idechannel(b);
+  acquire(&c->lock);
+  while(b->flags & B_QUEUED){
+    sleep(b, &c->lock);
+  }
+  release(&c->lock);
+}
 
-  release(&idelock);
+// Sync buf with disk.
+void
+iderw(struct buf *b)
+{
+  iderwstart(b);
+  iderwwait(b);
 }
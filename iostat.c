@@ -0,0 +1,21 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "iostat.h"
+
+// Print disk request and queue statistics.
+
+int
+main(void)
+{
+  struct iostat st;
+
+  if(iostat(&st) < 0){
+    printf(2, "iostat: iostat failed\n");
+    exit();
+  }
+  printf(1, "requests %d, commands %d, merged %d, past deadline %d\n",
+         st.nreq, st.ncmd, st.nmerged, st.ndeadline);
+  printf(1, "queue depth %d, at most %d\n", st.depth, st.maxdepth);
+  exit();
+}
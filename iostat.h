@@ -0,0 +1,10 @@
+// Disk request statistics, returned by iostat().
+
+struct iostat {
+  uint nreq;          // block requests queued
+  uint ncmd;          // disk commands issued for them
+  uint nmerged;       // requests merged into another's command
+  uint ndeadline;     // requests started out of order, having waited too long
+  uint depth;         // requests queued now
+  uint maxdepth;      // ... and at most
+};
@@ -1,6 +1,27 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Free memory is kept by a binary buddy allocator: kmem.free[k]
+// lists free blocks of 2^k physically contiguous pages, aligned
+// to their size.  kallocpages()/kfreepages() hand out whole
+// blocks; freeing a block merges it with its buddy whenever
+// the buddy is free too.
+//
+// Each CPU keeps a small cache of free single pages in front of
+// the buddy lists, so the common kalloc()/kfree() path only
+// takes a lock that no other CPU normally touches.  Pages move
+// between a CPU cache and the buddy lists in batches.
+//
+// Each CPU also keeps a pool of pages that were zeroed while
+// it had nothing to run (see kzidle()).  kzalloc() hands those
+// out, so fork/exec/sbrk don't pay for the memset.
+//
+// A page may be shared (see text.c): kdup() adds a reference
+// and kfree() only frees the page when the last one is dropped.
+//
+// Callers say what a page is for with kuse(), so memstat() can
+// report memory by use.  kfree() drops the page from the count.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +29,12 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "memstat.h"
+
+#define KCACHEMAX   64  // most free pages a CPU cache may hold
+#define KCACHEBATCH 16  // pages moved per refill or drain
+#define KZEROMAX    32  // most pre-zeroed pages a CPU keeps
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,14 +42,51 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;  // buddy lists only
+};
+
+// Per-page state, indexed by physical page number.
+struct page {
+  uchar order;  // order of the free block starting here
+  uchar use;    // PG_* if allocated, PGFREE if it heads
+                // a block on kmem.free[order]
+  ushort ref;   // references beyond the first, see kdup()
+};
+
+#define PGFREE  0xFF
+
+// Per-CPU free page cache.  The lock is only contended
+// when another CPU steals pages because kmem is empty.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  uint nalloc;   // kalloc() calls on this CPU
+  uint nhit;     // ... served straight from the cache
+  uint nrefill;  // batches taken from the buddy lists
+  uint ndrain;   // batches given back to the buddy lists
+  struct run *zerolist;  // pages known to be all zero
+  int nzero;
+  uint nzalloc;  // kzalloc() calls on this CPU
+  uint nzhit;    // ... served from zerolist
+  int nuse[NPGUSE];  // pages by use, counted on this CPU;
+                     // only the sum over CPUs means anything
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];  // free blocks of each order
+  int nfree[MAXORDER+1];
+  uint nsplit;  // blocks split to satisfy a smaller request
+  uint nmerge;  // blocks merged with their buddy on free
+  struct page page[PHYSTOP/PGSIZE];
+  struct kcache cache[NCPU];
 } kmem;
 
+#define PGNUM(v)  (V2P(v) / PGSIZE)
+#define PGVA(n)   ((struct run*)P2V((n) * PGSIZE))
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +95,11 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  struct kcache *kc;
+
   initlock(&kmem.lock, "kmem");
+  for(kc = kmem.cache; kc < &kmem.cache[NCPU]; kc++)
+    initlock(&kc->lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -43,37 +111,275 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Return this CPU's page cache.
+static struct kcache*
+mycache(void)
+{
+  struct kcache *kc;
+
+  pushcli();
+  kc = &kmem.cache[cpuid()];
+  popcli();
+  return kc;
+}
+
+// Count n more pages for use, on this CPU.
+static void
+kcount(int use, int n)
+{
+  pushcli();
+  kmem.cache[cpuid()].nuse[use] += n;
+  popcli();
+}
+
+// Page v is being freed: drop it from the count of its use.
+static void
+kunuse(char *v)
+{
+  struct page *pg;
+
+  pg = &kmem.page[PGNUM(v)];
+  if(pg->use == PGFREE)
+    panic("kfree: page is free");
+  if(pg->use != PG_KERNEL){
+    kcount(pg->use, -1);
+    pg->use = PG_KERNEL;
+  }
+}
+
+//PAGEBREAK!
+// Buddy lists.  Callers hold kmem.lock (or run before
+// kinit2(), when only one CPU is up).
+
+static void
+buddypush(struct run *r, int order)
+{
+  struct page *pg;
+
+  pg = &kmem.page[PGNUM(r)];
+  pg->order = order;
+  pg->use = PGFREE;
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+}
+
+static void
+buddyunlink(struct run *r, int order)
+{
+  kmem.page[PGNUM(r)].use = PG_KERNEL;
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+}
+
+// Take a block of 2^order pages off the buddy lists,
+// splitting a larger block if necessary.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.free[k];
+  buddyunlink(r, k);
+  // Give back the upper half until the block is the right size.
+  while(k > order){
+    k--;
+    buddypush((struct run*)((char*)r + (PGSIZE << k)), k);
+    kmem.nsplit++;
+  }
+  return r;
+}
+
+// Put a block of 2^order pages on the buddy lists,
+// merging it with its buddy as long as the buddy is free.
+static void
+buddyfree(struct run *r, int order)
+{
+  uint n, bn;
+  struct page *pg;
+
+  n = PGNUM(r);
+  while(order < MAXORDER){
+    bn = n ^ (1 << order);
+    if(bn >= PHYSTOP/PGSIZE)
+      break;
+    pg = &kmem.page[bn];
+    if(pg->use != PGFREE || pg->order != order)
+      break;
+    buddyunlink(PGVA(bn), order);
+    n &= ~(1 << order);
+    order++;
+    kmem.nmerge++;
+  }
+  buddypush(PGVA(n), order);
+}
+
+// Put the pages of [vstart, vend) on the buddy lists as the
+// largest aligned blocks that fit, rather than a page at a time:
+// only the first page of each block is written, so boot doesn't
+// touch every page of memory.
 void
 freerange(void *vstart, void *vend)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  uint n, e;
+  int order;
+
+  n = PGNUM(PGROUNDUP((uint)vstart));
+  e = V2P(vend) / PGSIZE;
+  while(n < e){
+    for(order = MAXORDER; order > 0; order--)
+      if(n % (1 << order) == 0 && n + (1 << order) <= e)
+        break;
+    buddyfree(PGVA(n), order);
+    n += 1 << order;
+  }
+}
+
+// Move up to KCACHEBATCH pages from the buddy lists into kc.
+// Caller must hold kc->lock.
+static void
+krefill(struct kcache *kc)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KCACHEBATCH && (r = buddyalloc(0)) != 0; i++){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->nfree++;
+  }
+  release(&kmem.lock);
+  kc->nrefill++;
+}
+
+// Give KCACHEBATCH pages from kc back to the buddy lists.
+// Caller must hold kc->lock.
+static void
+kdrain(struct kcache *kc)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KCACHEBATCH && (r = kc->freelist) != 0; i++){
+    kc->freelist = r->next;
+    kc->nfree--;
+    buddyfree(r, 0);
+  }
+  release(&kmem.lock);
+  kc->ndrain++;
 }
+
+// Take a page for kc's CPU: from its cache, refilling it from
+// the buddy lists if needed, and as a last resort from its
+// zero pool.
+// Caller must hold kc->lock.
+static struct run*
+kget(struct kcache *kc)
+{
+  struct run *r;
+
+  if(kc->freelist == 0)
+    krefill(kc);
+  if((r = kc->freelist) != 0){
+    kc->freelist = r->next;
+    kc->nfree--;
+  } else if((r = kc->zerolist) != 0){
+    kc->zerolist = r->next;
+    kc->nzero--;
+  }
+  return r;
+}
+
+// The buddy lists are empty: take a page from another CPU's cache.
+static struct run*
+ksteal(struct kcache *self)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  for(kc = kmem.cache; kc < &kmem.cache[ncpu]; kc++){
+    if(kc == self)
+      continue;
+    acquire(&kc->lock);
+    if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+    } else if((r = kc->zerolist) != 0){
+      kc->zerolist = r->next;
+      kc->nzero--;
+    }
+    release(&kc->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
+  struct page *pg;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // A shared page is only freed with its last reference.
+  // If ref is 0 the caller holds the only one, so no one
+  // can be raising it concurrently.
+  pg = &kmem.page[PGNUM(v)];
+  if(pg->ref){
+    acquire(&kmem.lock);
+    if(pg->ref){
+      pg->ref--;
+      release(&kmem.lock);
+      return;
+    }
+    release(&kmem.lock);
+  }
+
+  kunuse(v);
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(r, 0);
+    return;
+  }
+
+  kc = mycache();
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > KCACHEMAX)
+    kdrain(kc);
+  release(&kc->lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +389,218 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock)
+    return (char*)buddyalloc(0);
+
+  kc = mycache();
+  acquire(&kc->lock);
+  kc->nalloc++;
+  if(kc->freelist)
+    kc->nhit++;
+  r = kget(kc);
+  release(&kc->lock);
+
+  if(r == 0)
+    r = ksteal(kc);
+  return (char*)r;
+}
 
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if no large enough block is free.
+char*
+kallocpages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kallocpages");
+  if(order == 0)
+    return kalloc();
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = buddyalloc(order);
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Free a block returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  int i;
+
+  if(order < 0 || order > MAXORDER ||
+     (uint)v % (PGSIZE << order) || v < end || V2P(v) >= PHYSTOP)
+    panic("kfreepages");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  for(i = 0; i < (1 << order); i++)
+    kunuse(v + i*PGSIZE);
+#ifdef KALLOC_JUNK
+  memset(v, 1, PGSIZE << order);
+#endif
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree((struct run*)v, order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Record that the page at v, just allocated, is for use (PG_*).
+void
+kuse(char *v, int use)
+{
+  kusepages(v, 0, use);
+}
+
+// Record that the block at v from kallocpages(order) is for use.
+void
+kusepages(char *v, int order, int use)
+{
+  int i;
+
+  if(use <= PG_KERNEL || use >= NPGUSE)
+    panic("kuse");
+  for(i = 0; i < (1 << order); i++)
+    kmem.page[PGNUM(v) + i].use = use;
+  kcount(use, 1 << order);
+}
+
+// Take another reference to page v, which the caller
+// holds a reference to.  Each reference is dropped
+// with kfree().
+void
+kdup(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kdup");
+  acquire(&kmem.lock);
+  kmem.page[PGNUM(v)].ref++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to page v.
+int
+krefs(char *v)
+{
+  return kmem.page[PGNUM(v)].ref + 1;
+}
+
+// Allocate one zeroed 4096-byte page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock){
+    if((r = (struct run*)kalloc()) != 0)
+      memset(r, 0, PGSIZE);
+    return (char*)r;
+  }
+
+  kc = mycache();
+  acquire(&kc->lock);
+  kc->nzalloc++;
+  if((r = kc->zerolist) != 0){
+    kc->zerolist = r->next;
+    kc->nzero--;
+    kc->nzhit++;
+    r->next = 0;  // the only non-zero word
+  }
+  release(&kc->lock);
+
+  if(r == 0 && (r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Called by scheduler() when this CPU found nothing to run:
+// zero one free page and add it to the CPU's zero pool.
+void
+kzidle(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock)
+    return;
+  kc = mycache();
+  acquire(&kc->lock);
+  r = 0;
+  if(kc->nzero < KZEROMAX)
+    r = kget(kc);
+  release(&kc->lock);
+  if(r == 0)
+    return;
+
+  // The page is ours until it is on zerolist,
+  // so zero it without holding the lock.
+  memset(r, 0, PGSIZE);
+
+  acquire(&kc->lock);
+  r->next = kc->zerolist;
+  kc->zerolist = r;
+  kc->nzero++;
+  release(&kc->lock);
+}
+
+// Fill in st with the pages of memory by use.
+void
+kmemstat(struct memstat *st)
+{
+  struct kcache *kc;
+  int k, u;
+
+  memset(st, 0, sizeof(*st));
+  st->kernel = (PGROUNDUP(V2P(end)) - EXTMEM) / PGSIZE;
+  st->total = PHYSTOP/PGSIZE - PGNUM(PGROUNDUP((uint)end));
+  acquire(&kmem.lock);
+  for(k = 0; k <= MAXORDER; k++)
+    st->free += kmem.nfree[k] << k;
+  release(&kmem.lock);
+  // The CPU counters are read without their locks;
+  // the totals are only a snapshot anyway.
+  for(kc = kmem.cache; kc < &kmem.cache[ncpu]; kc++){
+    st->free += kc->nfree + kc->nzero;
+    for(u = 0; u < NPGUSE; u++)
+      st->use[u] += kc->nuse[u];
+  }
+  st->use[PG_KERNEL] = st->total - st->free;
+  for(u = PG_KERNEL + 1; u < NPGUSE; u++)
+    st->use[PG_KERNEL] -= st->use[u];
+}
+
+// Print buddy fragmentation and per-CPU allocator
+// counters to the console.
+// Runs when user types ^F on console.
+// No lock, like procdump().
+void
+kmemdump(void)
+{
+  struct kcache *kc;
+  int k, n, top;
+
+  n = 0;
+  top = -1;
+  cprintf("kmem: free blocks by order:");
+  for(k = 0; k <= MAXORDER; k++){
+    cprintf(" %d", kmem.nfree[k]);
+    n += kmem.nfree[k] << k;
+    if(kmem.nfree[k])
+      top = k;
+  }
+  cprintf("\nkmem: %d free pages, largest block order %d,"
+          " %d splits %d merges\n", n, top, kmem.nsplit, kmem.nmerge);
+  for(kc = kmem.cache; kc < &kmem.cache[ncpu]; kc++)
+    cprintf("cpu%d: cached %d alloc %d hit %d refill %d drain %d"
+            " zeroed %d zalloc %d zhit %d\n",
+            kc - kmem.cache, kc->nfree, kc->nalloc, kc->nhit,
+            kc->nrefill, kc->ndrain, kc->nzero, kc->nzalloc, kc->nzhit);
+}
@@ -28,6 +28,17 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Committed blocks are not written to their home locations
+// right away: they stay dirty in the buffer cache, and the next
+// transaction is appended to the log after them, so a block
+// written by many transactions may appear in the log more than
+// once (recovery installs the log in order, so the last copy
+// wins).  checkpoint() writes the cached blocks home, in block
+// order, and empties the log.  It runs when the log is nearly
+// full, and every FLUSHTICKS ticks from the flusher thread.  It
+// runs only when no FS system calls are active, so the cached
+// blocks hold exactly what the log does.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,9 +52,10 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // in commit() or checkpoint(), please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // committed, as on disk
+  struct logheader cur;  // the transaction being built
 };
 struct log log;
 
@@ -65,7 +77,8 @@ initlog(int dev)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// in log order, since a block may be logged more than once.
 static void
 install_trans(void)
 {
@@ -112,6 +125,42 @@ write_head(void)
   brelse(buf);
 }
 
+// Write the committed blocks, which are dirty in the buffer
+// cache, to their home locations and empty the log.
+// The writes go to the disk in block order, all before
+// waiting for any.
+static void
+checkpoint(void)
+{
+  struct buf *b[LOGSIZE];
+  uint blocks[LOGSIZE];
+  int i, j, n;
+  uint bn;
+
+  // Sort the distinct block numbers.
+  n = 0;
+  for (i = 0; i < log.lh.n; i++) {
+    bn = log.lh.block[i];
+    for (j = n; j > 0 && blocks[j-1] > bn; j--)
+      ;
+    if (j > 0 && blocks[j-1] == bn)
+      continue;
+    memmove(&blocks[j+1], &blocks[j], (n - j) * sizeof(blocks[0]));
+    blocks[j] = bn;
+    n++;
+  }
+
+  for (i = 0; i < n; i++) {
+    b[i] = bread(log.dev, blocks[i]);  // cached, so no disk read
+    bwriteasync(b[i]);
+  }
+  bwaitall(b, n);
+  for (i = 0; i < n; i++)
+    brelse(b[i]);
+  log.lh.n = 0;
+  write_head();    // Erase the transactions from the log
+}
+
 static void
 recover_from_log(void)
 {
@@ -129,7 +178,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.cur.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -173,37 +222,88 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the log, after the
+// blocks already committed.
+// The writes all go to the disk before waiting for any.
 static void
 write_log(void)
 {
+  struct buf *to[LOGSIZE];
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.cur.n; tail++) {
+    to[tail] = bread(log.dev, log.start+log.lh.n+tail+1); // log block
+    struct buf *from = bread(log.dev, log.cur.block[tail]); // cache block
+    memmove(to[tail]->data, from->data, BSIZE);
+    bwriteasync(to[tail]);  // write the log
     brelse(from);
-    brelse(to);
   }
+  bwaitall(to, log.cur.n);
+  for (tail = 0; tail < log.cur.n; tail++)
+    brelse(to[tail]);
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  int i;
+
+  if (log.cur.n > 0) {
     write_log();     // Write modified blocks from cache to log
+    for (i = 0; i < log.cur.n; i++)
+      log.lh.block[log.lh.n + i] = log.cur.block[i];
+    log.lh.n += log.cur.n;
+    log.cur.n = 0;
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  }
+  // Leave room for the next transactions.
+  if (log.lh.n + 3*MAXOPBLOCKS > LOGSIZE)
+    checkpoint();
+}
+
+// Checkpoint the log, so that committed blocks don't wait in
+// the cache for the log to fill up.
+static void
+logflush(void)
+{
+  acquire(&log.lock);
+  while (log.committing || log.outstanding > 0)
+    sleep(&log, &log.lock);
+  if (log.lh.n == 0) {
+    release(&log.lock);
+    return;
+  }
+  log.committing = 1;
+  release(&log.lock);
+
+  checkpoint();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Kernel thread that checkpoints the log every FLUSHTICKS ticks.
+void
+flusher(void)
+{
+  uint ticks0;
+
+  for (;;) {
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while (ticks - ticks0 < FLUSHTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    logflush();
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will log it and checkpoint()
+// will write it home.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,19 +315,20 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n + log.cur.n >= LOGSIZE ||
+      log.lh.n + log.cur.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = 0; i < log.cur.n; i++) {
+    if (log.cur.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
+  log.cur.block[i] = b->blockno;
+  if (i == log.cur.n)
+    log.cur.n++;
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
@@ -0,0 +1,50 @@
+//
+// Test for madvise() and for free() giving memory back.
+//
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mman.h"
+
+#define PAGE 4096
+
+int main(void) {
+    char *p, *top;
+    int i, bad = 0;
+
+    p = sbrk(9 * PAGE);
+    p = (char*)(((uint)p + PAGE - 1) & ~(PAGE - 1));
+    for (i = 0; i < 8 * PAGE; i++)
+        p[i] = 'x';
+    if (madvise(p + PAGE, 4 * PAGE, MADV_DONTNEED) < 0) {
+        printf(1, "madvise failed\n");
+        exit();
+    }
+    for (i = 0; i < 8 * PAGE; i++) {
+        if ((i >= PAGE && i < 5 * PAGE) ? p[i] != 0 : p[i] != 'x')
+            bad++;
+    }
+    p[2 * PAGE] = 'y';//discarded pages must still be writable
+    if (p[2 * PAGE] != 'y')
+        bad++;
+    printf(1, "contents after madvise: %s\n", bad ? "WRONG" : "ok");
+
+    //bad arguments
+    if (madvise(p + 1, PAGE, MADV_DONTNEED) != -1 ||
+        madvise(p, PAGE, 0) != -1 ||
+        madvise(sbrk(0), PAGE, MADV_DONTNEED) != -1)
+        printf(1, "bad arguments accepted\n");
+    else
+        printf(1, "bad arguments rejected: ok\n");
+
+    //free() should hand a big block at the top of the heap back
+    top = sbrk(0);
+    for (i = 0; i < 5; i++) {
+        p = malloc(64 * PAGE);
+        memset(p, i, 64 * PAGE);
+        free(p);
+    }
+    printf(1, "heap grew by %d bytes over 5 malloc/free cycles\n", sbrk(0) - top);
+    exit();
+}
@@ -11,14 +11,48 @@ static void mpmain(void)  __attribute__((noreturn));
 extern pde_t *kpgdir;
 extern char end[]; // first address after kernel loaded from ELF file
 
+// Boot-phase timestamps, printed when main() is done.
+static struct {
+  char *phase;
+  uint64 tsc;
+} stamps[8];
+static int nstamp;
+
+static void
+stamp(char *phase)
+{
+  if(nstamp < NELEM(stamps)){
+    stamps[nstamp].phase = phase;
+    stamps[nstamp].tsc = rdtsc();
+    nstamp++;
+  }
+}
+
+// Print the time each phase took, in thousands of cycles
+// (1024, to keep 64-bit division out of the kernel).
+static void
+stampdump(void)
+{
+  int i;
+
+  cprintf("boot kcycles:");
+  for(i = 1; i < nstamp; i++)
+    cprintf(" %s %d", stamps[i].phase,
+            (uint)((stamps[i].tsc - stamps[i-1].tsc) >> 10));
+  cprintf("\n");
+}
+
 // Bootstrap processor starts running C code here.
 // Allocate a real stack and switch to it, first
 // doing some setup required for memory allocator to work.
 int
 main(void)
 {
+  stamp("start");
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
+  stamp("kinit1");
   kvmalloc();      // kernel page table
+  stamp("kvmalloc");
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
   seginit();       // segment descriptors
@@ -26,14 +60,26 @@ main(void)
   ioapicinit();    // another interrupt controller
   consoleinit();   // console hardware
   uartinit();      // serial port
+  stamp("devices");
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipes
+  icacheinit();    // inode cache
+  textinit();      // shared program text
   ideinit();       // disk 
+  swapinit();      // swap area
+  stamp("caches");
   startothers();   // start other processors
+  stamp("startothers");
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  stamp("kinit2");
   userinit();      // first user process
+  kthread("reaper", reaper);    // frees the memory of exited processes
+  kthread("flusher", flusher);  // writes the log home
+  stamp("userinit");
+  stampdump();
   mpmain();        // finish this processor's setup
 }
 
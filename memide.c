@@ -1,5 +1,14 @@
 // Fake IDE disk; stores blocks in memory.
 // Useful for running kernel without scratch disk.
+//
+// The RAM disk is as large as the superblock of the file
+// system image linked into the kernel says, so mkfs -t can
+// leave the unused blocks out of the image.  Blocks in the
+// image are used where they are; the others get memory when
+// they are first used.  Nothing is copied: reading a block
+// points the buf's data at the block, so the buffer cache
+// and the disk share it, and the file system modifies the
+// block in place.
 
 #include "types.h"
 #include "defs.h"
@@ -12,22 +21,77 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+#include "memstat.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_fsmem_img_start[], _binary_fsmem_img_size[];
 
-static int disksize;
-static uchar *memdisk;
+static struct {
+  struct spinlock lock;
+  uint size;         // blocks
+  uchar **block;     // where each block is, 0 if not yet anywhere
+  uchar *free;       // rest of the page the last block came from
+  struct iostat stats;
+} ramdisk;
 
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  struct superblock *sb;
+  uint i, n, order;
+
+  initlock(&ramdisk.lock, "ramdisk");
+  n = (uint)_binary_fsmem_img_size/BSIZE;
+  sb = (struct superblock*)(_binary_fsmem_img_start + BSIZE);
+  ramdisk.size = n > 1 && sb->size > n ? sb->size : n;
+  for(order = 0; (PGSIZE << order) < ramdisk.size*sizeof(uchar*); order++)
+    ;
+  if((ramdisk.block = (uchar**)kallocpages(order)) == 0)
+    panic("ramdisk: no memory for block table");
+  for(i = 0; i < ramdisk.size; i++)
+    ramdisk.block[i] = i < n ? _binary_fsmem_img_start + i*BSIZE : 0;
+}
+
+// Return where block blockno is, giving it zeroed memory
+// if it is not yet anywhere.
+static uchar*
+ramblock(uint blockno)
+{
+  uchar *p;
+
+  acquire(&ramdisk.lock);
+  if((p = ramdisk.block[blockno]) == 0){
+    if(ramdisk.free == 0){
+      if((ramdisk.free = (uchar*)kzalloc()) == 0)
+        panic("ramdisk: out of memory");
+      kuse((char*)ramdisk.free, PG_BUF);
+    }
+    p = ramdisk.block[blockno] = ramdisk.free;
+    ramdisk.free += BSIZE;
+    if((uint)ramdisk.free % PGSIZE == 0)
+      ramdisk.free = 0;
+  }
+  release(&ramdisk.lock);
+  return p;
+}
+
+// Only the file system image is here, as disk 1.
+int
+idepresent(int dev)
+{
+  return dev == 1;
+}
+
+// Blocks on device dev.
+uint
+idesize(int dev)
+{
+  return dev == 1 ? ramdisk.size : 0;
 }
 
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int ch)
 {
   // no-op
 }
@@ -46,15 +110,43 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
+  if(b->blockno >= ramdisk.size)
     panic("iderw: block out of range");
 
-  p = memdisk + b->blockno*BSIZE;
+  p = ramblock(b->blockno);
+  ramdisk.stats.nreq++;
+  ramdisk.stats.ncmd++;
 
-  if(b->flags & B_DIRTY){
-    b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
-  } else
-    memmove(b->data, p, BSIZE);
+  // A buf not yet pointing at its block is being written
+  // without having been read.
+  if(b->data != p){
+    if(b->flags & B_DIRTY)
+      memmove(p, b->data, BSIZE);
+    b->data = p;
+  }
+  b->flags &= ~B_DIRTY;
   b->flags |= B_VALID;
 }
+
+// The memory disk is done at once, so these just
+// complete the request before returning.
+void
+iderwstart(struct buf *b)
+{
+  iderw(b);
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    bdone(b);
+  }
+}
+
+void
+iderwwait(struct buf *b)
+{
+}
+
+void
+idestat(struct iostat *st)
+{
+  *st = ramdisk.stats;
+}
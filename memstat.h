@@ -0,0 +1,32 @@
+// Memory statistics, returned by memstat() and procmem().
+
+// What an allocated page is used for.
+#define PG_KERNEL  0  // anything not listed below
+#define PG_KSTACK  1  // process kernel stacks
+#define PG_PGTBL   2  // page directories and page tables
+#define PG_USER    3  // user memory
+#define PG_SLAB    4  // slabs: pipes, open files, inodes
+#define PG_TEXT    5  // cached program segments
+#define PG_BUF     6  // buffer cache
+#define NPGUSE     7
+
+struct memstat {
+  uint total;         // pages managed by kalloc()
+  uint free;          // ... of which free
+  uint use[NPGUSE];   // ... allocated, by use
+  uint kernel;        // pages of kernel text, data and bss
+  uint nbuf;          // buffers in the block cache
+  uint bufhit;        // block lookups that found the block cached
+  uint bufmiss;       // ... and that had to read it
+};
+
+struct procmem {
+  int pid;
+  int state;          // enum procstate
+  char name[16];
+  uint sz;            // size of the address space
+  uint resident;      // pages mapped
+  uint shared;        // ... of which mapped elsewhere too
+  uint swapped;       // pages in the swap area
+  uint pgtbl;         // page-table pages, including the directory
+};
@@ -20,13 +20,17 @@
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+uint fssize = FSSIZE;   // -b
+uint ninodes = NINODES; // -i
+int nbitmap;
+int ninodeblocks;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+int stripefd = -1;  // second disk of a striped image pair
+int trim;           // stop the image after the last block in use
 struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
@@ -38,6 +42,7 @@ void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
+int seeksect(uint sec);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 
@@ -76,10 +81,45 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  // -b n: make the file system n blocks.
+  // -i n: with n inodes.
+  // -s: stripe the file system across two images, as disks 1
+  // and 2 (see ide.c), in chunks of STRIPE blocks.
+  // -t: leave the free blocks at the end out of the image;
+  // the RAM disk of kernelmemfs supplies them (see memide.c).
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-s") == 0 && argc > 2){
+      stripefd = open(argv[2], O_RDWR|O_CREAT|O_TRUNC, 0666);
+      if(stripefd < 0){
+        perror(argv[2]);
+        exit(1);
+      }
+      argc--;
+      argv++;
+    } else if(strcmp(argv[1], "-b") == 0 && argc > 2){
+      fssize = strtoul(argv[2], 0, 0);
+      argc--;
+      argv++;
+    } else if(strcmp(argv[1], "-i") == 0 && argc > 2){
+      ninodes = strtoul(argv[2], 0, 0);
+      argc--;
+      argv++;
+    } else if(strcmp(argv[1], "-t") == 0)
+      trim = 1;
+    else
+      argc = 0;
+  }
+  if(argc < 2 || (trim && stripefd >= 0)){
+    fprintf(stderr, "Usage: mkfs [-b blocks] [-i inodes] [-s fs1.img | -t] fs.img files...\n");
     exit(1);
   }
+  // Directory entries hold 16-bit inode numbers.
+  if(ninodes < ROOTINO + 1 || ninodes > 0xffff){
+    fprintf(stderr, "mkfs: bad inode count %u\n", ninodes);
+    exit(1);
+  }
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
@@ -92,22 +132,31 @@ main(int argc, char *argv[])
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  if(fssize < nmeta + 2*STRIPE){
+    fprintf(stderr, "mkfs: %u blocks is too small\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.magic = xint(FSMAGIC);
+  sb.stripe = xint(stripefd >= 0 ? STRIPE : 0);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  // The images start empty, so writing the last blocks of
+  // each sizes it, leaving the rest as a hole that reads as
+  // zeroes and takes no space, however large the disk.
+  for(i = fssize - 2*STRIPE; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -164,17 +213,40 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  if(trim && ftruncate(fsfd, (off_t)freeblock * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+
   exit(0);
 }
 
-void
-wsect(uint sec, void *buf)
+// Seek to sector sec of the file system,
+// returning the image file that holds it.
+int
+seeksect(uint sec)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  uint chunk;
+  int fd;
+
+  fd = fsfd;
+  if(stripefd >= 0){
+    chunk = sec / STRIPE;
+    if(chunk % 2)
+      fd = stripefd;
+    sec = chunk/2*STRIPE + sec%STRIPE;
+  }
+  if(lseek(fd, (off_t)sec * BSIZE, 0) != (off_t)sec * BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
+  return fd;
+}
+
+void
+wsect(uint sec, void *buf)
+{
+  if(write(seeksect(sec), buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -210,11 +282,7 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
+  if(read(seeksect(sec), buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -238,20 +306,61 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used <= fssize);
+  for(b = 0; b < used; b += BPB){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB && b + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + b/BPB);
+    wsect(sb.bmapstart + b/BPB, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block address of block fbn of the file
+// with inode din, allocating it if necessary, like bmap()
+// in fs.c.
+uint
+dbmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, n;
+  int level;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(freeblock++);
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  n = NINDIRECT;
+  for(level = 1; fbn >= n; level++){
+    fbn -= n;
+    n *= NINDIRECT;
+  }
+  if(xint(din->addrs[NDIRECT+level-1]) == 0)
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  addr = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--){
+    n /= NINDIRECT;
+    rsect(addr, (char*)indirect);
+    if(indirect[fbn/n] == 0){
+      indirect[fbn/n] = xint(freeblock++);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[fbn/n]);
+    fbn %= n;
+  }
+  return addr;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +368,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,23 +375,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = dbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
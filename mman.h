@@ -0,0 +1,2 @@
+// madvise() advice
+#define MADV_DONTNEED  4  // free the pages; they read as zeros after
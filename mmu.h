@@ -83,6 +83,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SPGSIZE         (PGSIZE*NPTENTRIES) // bytes mapped by a PTE_PS pde
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -94,12 +95,24 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (software-defined)
+#define PTE_SWAP        0x400   // Not present, in swap (software-defined)
+#define PTE_ZERO        0x800   // Not present, zero-fill on use (software-defined)
+
+// Page fault error code bits
+#define FEC_WR          0x002   // Fault was caused by a write
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Swap slot named by a PTE_SWAP entry, and such an entry
+#define PTE_SLOT(pte)   ((uint)(pte) >> PTXSHIFT)
+#define SWAPPTE(slot, flags) (((slot) << PTXSHIFT) | PTE_SWAP | \
+                              ((flags) & (PTE_W|PTE_U)))
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
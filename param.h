@@ -1,18 +1,25 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
+#define MAXORDER     10  // largest buddy block is 2^MAXORDER pages
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
+#define NTEXT        16  // cached program segments
+#define NIDLEINODE   50  // unused inodes kept cached
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes
+#define LOGSIZE      120  // max data blocks in on-disk log (header fills a block)
+#define FLUSHTICKS   300  // ticks between log checkpoints
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // least size of disk block cache
+#define BUFFRAC      16  // block cache may grow to 1/BUFFRAC of memory
+#define FSSIZE       1000  // size of file system mkfs makes by default
+#define STRIPE       8  // blocks per chunk of a striped file system
+#define SWAPDEV         0  // device holding the swap area (boot disk)
+#define SWAPSTART    4096  // first block of swap area, after the kernel
+#define NSWAPSLOT    2048  // pages of swap space
 #define QUANTUM	     500
 #define PRIORITY_INIT   10  // priority that initially is given to the process
 #define PRIORITY_MAX    100000
 #define PRIORITY_MIN    0
-#define SYSCALLS_NUMBER  28
+#define SYSCALLS_NUMBER  32
@@ -0,0 +1,103 @@
+// PCI bus enumeration, through configuration mechanism #1:
+// write the address of a configuration register to port 0xCF8,
+// then read or write the register at port 0xCFC.
+// Only bus 0 is scanned, which is all QEMU has.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_ADDR  0xcf8
+#define PCI_DATA  0xcfc
+
+#define NPCIDEV   32  // device slots on a bus
+
+static uint
+pciaddr(int bus, int dev, int func, int off)
+{
+  return 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (off & 0xfc);
+}
+
+// Read the configuration register at off of d.
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_ADDR, pciaddr(d->bus, d->dev, d->func, off));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_ADDR, pciaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_DATA, v);
+}
+
+// Fill in d from the configuration space of function
+// func of slot dev.  Returns 0 if nothing is there.
+static int
+pciprobe(struct pcidev *d, int dev, int func)
+{
+  uint id, class, bar;
+  int i;
+
+  d->bus = 0;
+  d->dev = dev;
+  d->func = func;
+  id = pciread(d, PCI_ID);
+  if((id & 0xffff) == 0xffff)
+    return 0;
+  d->vendor = id & 0xffff;
+  d->device = id >> 16;
+  class = pciread(d, PCI_CLASS);
+  d->class = class >> 24;
+  d->subclass = class >> 16;
+  d->progif = class >> 8;
+  d->irq = pciread(d, PCI_INTR);
+  for(i = 0; i < 6; i++){
+    bar = pciread(d, PCI_BAR0 + 4*i);
+    d->bar[i] = (bar & 1) ? bar & ~3 : bar & ~0xf;
+  }
+  return 1;
+}
+
+// Find the first function matching the arguments that are
+// not -1, fill in d and enable it as an I/O bus master.
+// Returns 0 if there is none.
+static int
+pcifind(struct pcidev *d, int vendor, int device, int class, int subclass)
+{
+  int dev, func;
+
+  for(dev = 0; dev < NPCIDEV; dev++)
+    for(func = 0; func < 8; func++){
+      if(!pciprobe(d, dev, func))
+        continue;
+      if((vendor < 0 || d->vendor == vendor) &&
+         (device < 0 || d->device == device) &&
+         (class < 0 || d->class == class) &&
+         (subclass < 0 || d->subclass == subclass)){
+        pciwrite(d, PCI_COMMAND, pciread(d, PCI_COMMAND) |
+                 PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+        return 1;
+      }
+      if(func == 0 && !(pciread(d, PCI_HEADER) & PCI_MULTIFUNC))
+        break;
+    }
+  return 0;
+}
+
+// Find a function by class and subclass.
+int
+pciclass(int class, int subclass, struct pcidev *d)
+{
+  return pcifind(d, -1, -1, class, subclass);
+}
+
+// Find a function by vendor and device ID.
+int
+pcidevice(int vendor, int device, struct pcidev *d)
+{
+  return pcifind(d, vendor, device, -1, -1);
+}
@@ -0,0 +1,27 @@
+// PCI configuration space.
+
+#define PCI_ID        0x00  // vendor (low 16 bits), device (high)
+#define PCI_COMMAND   0x04  // command (low 16 bits), status (high)
+#define PCI_CLASS     0x08  // revision, prog if, subclass, class
+#define PCI_HEADER    0x0c  // ..., header type (bits 16-23), ...
+#define PCI_BAR0      0x10  // base address registers, 6 of them
+#define PCI_INTR      0x3c  // interrupt line (low 8 bits)
+
+#define PCI_MULTIFUNC   (0x80<<16)  // in PCI_HEADER: has functions 1-7
+
+#define PCI_CMD_IO      0x1  // respond to I/O port accesses
+#define PCI_CMD_MEM     0x2  // respond to memory accesses
+#define PCI_CMD_MASTER  0x4  // may act as bus master (DMA)
+
+struct pcidev {
+  int bus;
+  int dev;
+  int func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;
+  uint bar[6];    // base addresses, with the type bits cleared
+};
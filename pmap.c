@@ -0,0 +1,31 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "memstat.h"
+
+// Print the memory use of each process, or just of
+// the process given, in KB.
+
+struct procmem pm[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid;
+
+  pid = argc > 1 ? atoi(argv[1]) : 0;
+  if((n = procmem(pm, NPROC)) < 0){
+    printf(2, "pmap: procmem failed\n");
+    exit();
+  }
+  printf(1, "pid\tname\tsize\trss\tshared\tswapped\tpgtbl\n");
+  for(i = 0; i < n; i++){
+    if(pid && pm[i].pid != pid)
+      continue;
+    printf(1, "%d\t%s\t%d\t%d\t%d\t%d\t%d\n", pm[i].pid, pm[i].name,
+           pm[i].sz/1024, pm[i].resident*4, pm[i].shared*4,
+           pm[i].swapped*4, pm[i].pgtbl*4);
+  }
+  exit();
+}
@@ -8,11 +8,20 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "myHeaders.h"
+#include "memstat.h"
 
 
+// The kernel stack of a process collected by wait(), queued
+// with its address space for the reaper to free.
+struct corpse {
+    struct corpse *next;
+    pde_t *pgdir;
+};
+
 struct {
     struct spinlock lock;
     struct proc proc[NPROC];
+    struct corpse *corpses;      // waiting for the reaper
 } ptable;
 
 static struct proc *initproc;
@@ -27,13 +36,13 @@ extern void trapret(void);
 
 static void wakeup1(void *chan);
 
-void original_scheduler(struct proc *, struct cpu *);
+int original_scheduler(struct proc *, struct cpu *);
 
-void modified_scheduler(struct proc *, struct cpu *);
+int modified_scheduler(struct proc *, struct cpu *);
 
-void priority_scheduler(struct proc *, struct cpu *);
+int priority_scheduler(struct proc *, struct cpu *);
 
-void mlq_scheduler(struct proc *, struct cpu *);
+int mlq_scheduler(struct proc *, struct cpu *);
 
 struct proc *highestPriorityProcess(void);
 
@@ -141,6 +150,7 @@ allocproc(void) {
     p->readyTime = 0;
     p->terminationTime = 0;
     p->queue_type = QUEUE_ONE;
+    p->insys = 0;
 
     release(&ptable.lock);
 
@@ -149,6 +159,7 @@ allocproc(void) {
         p->state = UNUSED;
         return 0;
     }
+    kuse(p->kstack, PG_KSTACK);
     sp = p->kstack + KSTACKSIZE;
 
     // Leave room for trap frame.
@@ -271,6 +282,8 @@ growproc(int n) {
 
     sz = curproc->sz;
     if (n > 0) {
+        if (sz + n > ULIBBASE || sz + n < sz)
+            return -1;
         if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
             return -1;
     } else if (n < 0) {
@@ -282,6 +295,22 @@ growproc(int n) {
     return 0;
 }
 
+// Give p the user address space pgdir, of size sz, and return
+// the page directory it had, for the caller to free.  Done under
+// ptable.lock so that procmem(), which walks other processes'
+// page tables under it, never sees one that is being freed.
+pde_t *
+setuvm(struct proc *p, pde_t *pgdir, uint sz) {
+    pde_t *old;
+
+    acquire(&ptable.lock);
+    old = p->pgdir;
+    p->pgdir = pgdir;
+    p->sz = sz;
+    release(&ptable.lock);
+    return old;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -387,6 +416,79 @@ exit(void) {
     panic("zombie exit");
 }
 
+// Free zombie p, handing its kernel stack and address space
+// to the reaper: freeing them takes a walk over the whole page
+// directory, too long to do in wait() under ptable.lock.
+// Caller must hold ptable.lock.
+static void
+bury(struct proc *p) {
+    struct corpse *c;
+
+    c = (struct corpse *) p->kstack;
+    c->pgdir = p->pgdir;
+    c->next = ptable.corpses;
+    ptable.corpses = c;
+    wakeup1(&ptable.corpses);
+    p->kstack = 0;
+    p->pgdir = 0;
+    p->pid = 0;
+    p->parent = 0;
+    p->name[0] = 0;
+    p->killed = 0;
+    p->state = UNUSED;
+}
+
+// Kernel thread that frees what bury() queues.
+void
+reaper(void) {
+    struct corpse *c, *next;
+
+    acquire(&ptable.lock);
+    for (;;) {
+        while (ptable.corpses == 0)
+            sleep(&ptable.corpses, &ptable.lock);
+        c = ptable.corpses;
+        ptable.corpses = 0;
+        release(&ptable.lock);
+        for (; c; c = next) {
+            next = c->next;
+            freevm(c->pgdir);
+            kfree((char *) c);
+        }
+        acquire(&ptable.lock);
+    }
+}
+
+// A kernel thread's first scheduling by scheduler()
+// will swtch here.  A kernel thread has no use for its
+// trap frame, so kthread() left the function to run in
+// its eip.
+static void
+kthreadstart(void) {
+    // Still holding ptable.lock from scheduler.
+    release(&ptable.lock);
+    ((void (*)(void)) myproc()->tf->eip)();
+    panic("kthread returned");
+}
+
+// Start a kernel thread running fn, which must not return.
+void
+kthread(char *name, void (*fn)(void)) {
+    struct proc *p;
+
+    if ((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+        panic("kthread");
+    p->context->eip = (uint) kthreadstart;
+    p->tf->eip = (uint) fn;
+    safestrcpy(p->name, name, sizeof(p->name));
+
+    acquire(&ptable.lock);
+
+    p->state = RUNNABLE;
+
+    release(&ptable.lock);
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
@@ -406,14 +508,7 @@ wait(void) {
             if (p->state == ZOMBIE) {
                 // Found one.
                 pid = p->pid;
-                kfree(p->kstack);
-                p->kstack = 0;
-                freevm(p->pgdir);
-                p->pid = 0;
-                p->parent = 0;
-                p->name[0] = 0;
-                p->killed = 0;
-                p->state = UNUSED;
+                bury(p);
                 release(&ptable.lock);
                 return pid;
             }
@@ -462,6 +557,7 @@ scheduler(void) {
     struct proc *p;
     p = NULL;
     struct cpu *c = mycpu();
+    int ran;
     c->proc = 0;
 
     for (;;) {
@@ -471,18 +567,19 @@ scheduler(void) {
         // Loop over process table looking for process to run.
         acquire(&ptable.lock);
 
+        ran = 0;
         switch (schedule_type) {
             case SCHED_TYPE_ORIGINAL:
-                original_scheduler(p, c);
+                ran = original_scheduler(p, c);
                 break;
             case SCHED_TYPE_MODIFIED:
-                modified_scheduler(p, c);
+                ran = modified_scheduler(p, c);
                 break;
             case SCHED_TYPE_PRIORITY:
-                priority_scheduler(p, c);
+                ran = priority_scheduler(p, c);
                 break;
             case SCHED_TYPE_MLQ:
-                mlq_scheduler(p, c);
+                ran = mlq_scheduler(p, c);
                 break;
             default:
                 break;
@@ -490,11 +587,16 @@ scheduler(void) {
 
         release(&ptable.lock);
 
+        // Nothing to run: spend the idle time zeroing free pages.
+        if (ran == 0)
+            kzidle();
     }
 }
 
-void
+int
 original_scheduler(struct proc *p, struct cpu *c) {
+    int ran = 0;
+
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
         if (p->state != RUNNABLE)
             continue;
@@ -513,11 +615,15 @@ original_scheduler(struct proc *p, struct cpu *c) {
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        ran++;
     }
+    return ran;
 }
 
-void
+int
 modified_scheduler(struct proc *p, struct cpu *c) {
+    int ran = 0;
+
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
         if (p->state != RUNNABLE)
             continue;
@@ -528,11 +634,15 @@ modified_scheduler(struct proc *p, struct cpu *c) {
         swtch(&(c->scheduler), p->context);
         switchkvm();//swtching to kernel mode
         c->proc = 0;
+        ran++;
     }
+    return ran;
 }
 
-void
+int
 priority_scheduler(struct proc *p, struct cpu *c) {
+    int ran = 0;
+
     p = highestPriorityProcess();
     if (p != myproc()) {
         // Switch to chosen process.  It is the process's job
@@ -549,11 +659,15 @@ priority_scheduler(struct proc *p, struct cpu *c) {
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        ran++;
     }
+    return ran;
 }
 
-void
+int
 mlq_scheduler(struct proc *p, struct cpu *c) {
+    int ran = 0;
+
     mlqChooseQueue();
     switch (executing_queue) {
         case QUEUE_ONE:
@@ -568,6 +682,7 @@ mlq_scheduler(struct proc *p, struct cpu *c) {
                 swtch(&(c->scheduler), p->context);
                 switchkvm();//swtching to kernel mode
                 c->proc = 0;
+                ran++;
                 p->queue_type = QUEUE_TWO;
             }
             break;
@@ -583,6 +698,7 @@ mlq_scheduler(struct proc *p, struct cpu *c) {
                 swtch(&(c->scheduler), p->context);
                 switchkvm();
                 c->proc = 0;
+                ran++;
                 p->queue_type = QUEUE_THREE;
             }
             break;
@@ -598,13 +714,13 @@ mlq_scheduler(struct proc *p, struct cpu *c) {
                 swtch(&(c->scheduler), p->context);
                 switchkvm();//swtching to kernel mode
                 c->proc = 0;
+                ran++;
             }
             break;
         default:
             break;
     }
-
-
+    return ran;
 }
 
 
@@ -780,7 +896,7 @@ procdump(void) {
             [RUNNING]   "run   ",
             [ZOMBIE]    "zombie"
     };
-    int i;
+    int i, n;
     struct proc *p;
     char *state;
     uint pc[10];
@@ -793,6 +909,8 @@ procdump(void) {
         else
             state = "???";
         cprintf("%d %s %s", p->pid, state, p->name);
+        if (p->pgdir && p->state != ZOMBIE && (n = swapcount(p->pgdir, p->sz)) > 0)
+            cprintf(" swapped %d", n);
         if (p->state == SLEEPING) {
             getcallerpcs((uint *) p->context->ebp + 2, pc);
             for (i = 0; i < 10 && pc[i] != 0; i++)
@@ -803,6 +921,67 @@ procdump(void) {
 }
 
 
+// Copy the memory use of up to n processes to the array
+// of struct procmem at user address addr.
+// Returns the number copied, or -1.
+int
+procmem(uint addr, int n) {
+    struct proc *p;
+    struct procmem pm;
+    int i;
+
+    i = 0;
+    for (p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++) {
+        acquire(&ptable.lock);
+        if (p->state == UNUSED || p->pgdir == 0) {
+            release(&ptable.lock);
+            continue;
+        }
+        memset(&pm, 0, sizeof(pm));
+        pm.pid = p->pid;
+        pm.state = p->state;
+        safestrcpy(pm.name, p->name, sizeof(pm.name));
+        pm.sz = p->sz;
+        uvmstat(p->pgdir, &pm);
+        release(&ptable.lock);
+        // copyout() may fault in a page, so not under ptable.lock.
+        if (copyout(myproc()->pgdir, addr + i * sizeof(pm), &pm, sizeof(pm)) < 0)
+            return -1;
+        i++;
+    }
+    return i;
+}
+
+// Pick a user page for swapout() to page out to slot.
+// The clock hand sweeps over the pages of processes that are
+// neither running (so no CPU has their PTEs in its TLB) nor in
+// a system call (so the kernel isn't using their memory).
+// Gives up after two sweeps; the first may only have cleared
+// accessed bits.  Returns the unmapped page, or 0.
+char *
+swapvictim(uint slot) {
+    static int hand;  // index into ptable.proc
+    static uint va;   // next address in that process
+    struct proc *p;
+    char *v;
+    int i, n;
+
+    n = 2 * (PHYSTOP / PGSIZE);
+    acquire(&ptable.lock);
+    for (i = 0; i <= 2 * NPROC && n > 0; i++) {
+        p = &ptable.proc[hand];
+        if ((p->state == RUNNABLE || p->state == SLEEPING) && !p->insys &&
+            (v = swapscan(p->pgdir, p->sz, &va, &n, slot)) != 0) {
+            release(&ptable.lock);
+            return v;
+        }
+        hand = (hand + 1) % NPROC;
+        va = 0;
+    }
+    release(&ptable.lock);
+    return 0;
+}
+
 // returns children of running process
 // actually its just a string of pid's next to each other with 0 between them
 char *
@@ -867,8 +1046,9 @@ sys_changePolicy(void) {
 
 int
 sys_waitForChild(void) {
-    struct timeStruct *time;
-    argptr(0, (void *) &time, sizeof(*time));
+    struct timeStruct *time, t;
+    if (argptr(0, (void *) &time, sizeof(*time), 1) < 0)
+        return -1;
     struct proc *p;
     int havekids, pid;
     struct proc *curproc = myproc();
@@ -885,32 +1065,24 @@ sys_waitForChild(void) {
             if (p->state == ZOMBIE) {
                 // Found one.
                 pid = p->pid;
-                kfree(p->kstack);
-                p->kstack = 0;
-                freevm(p->pgdir);
-                p->pid = 0;
-                p->parent = 0;
-                p->name[0] = 0;
-                p->killed = 0;
-                p->state = UNUSED;
-                time->creationTime = p->creationTime;
-                time->terminationTime = p->terminationTime;
-                time->sleepingTime = p->sleepingTime;
-                time->readyTime = p->readyTime;
-                time->runningTime = p->runningTime;
+                bury(p);
+                t.creationTime = p->creationTime;
+                t.terminationTime = p->terminationTime;
+                t.sleepingTime = p->sleepingTime;
+                t.readyTime = p->readyTime;
+                t.runningTime = p->runningTime;
                 release(&ptable.lock);
+                // Not under ptable.lock: writing *time may fault.
+                copyout(curproc->pgdir, (uint) time, &t, sizeof(t));
                 return pid;
             }
         }
 
         // No point waiting if we don't have any children.
         if (!havekids || curproc->killed) {
-            time->creationTime = 0;
-            time->terminationTime = 0;
-            time->sleepingTime = 0;
-            time->readyTime = 0;
-            time->runningTime = 0;
             release(&ptable.lock);
+            memset(&t, 0, sizeof(t));
+            copyout(curproc->pgdir, (uint) time, &t, sizeof(t));
             return -1;
         }
 
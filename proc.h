@@ -48,6 +48,7 @@ struct proc {
     struct context *context;     // swtch() here to run process
     void *chan;                  // If non-zero, sleeping on chan
     int killed;                  // If non-zero, have been killed
+    int insys;                   // In a system call: no swapping out
     struct file *ofile[NOFILE];  // Open files
     struct inode *cwd;           // Current directory
     char name[16];               // Process name (debugging)
@@ -60,7 +61,7 @@ struct proc {
     int priority;                // fixed priority that'll be added to changablePriority
     int changablePriority;       // the priority that changes every time
     int time_slot;
-    int counter[30];             // Number of times a process's system calls have been invoked
+    int counter[SYSCALLS_NUMBER]; // Number of times a process's system calls have been invoked
     int queue_type;              // shows process queue type
 //    int queue_number;            // the number in queue
 };
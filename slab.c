@@ -0,0 +1,263 @@
+// Slab allocator for small fixed-size kernel objects
+// (pipes, open files, in-memory inodes, disk buffers).
+//
+// A slab cache hands out objects of a single size.  Each slab
+// is one page from kalloc(): a struct slab header at the start
+// of the page, followed by as many objects as fit.  Free objects
+// in a slab are chained through their first word.  slabfree()
+// finds an object's slab by rounding its address down to a page.
+//
+// In front of the slabs each CPU keeps a magazine, a small
+// stack of free objects.  slaballoc()/slabfree() use it with
+// interrupts off and without taking the cache lock; objects
+// move between a magazine and the slabs in batches.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "memstat.h"
+
+#define NSLABCACHE  8   // most slab caches
+#define MAGSIZE    16   // most objects in a CPU magazine
+#define MAGBATCH    8   // objects moved per fill or flush
+
+struct slabcache;
+
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  struct slabcache *sc;
+  void *freelist;  // free objects in this slab
+  int inuse;       // objects handed out
+};
+
+// Objects start here in each slab page.
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7)
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct slabcache {
+  char *name;
+  uint size;       // object size, rounded up
+  int perslab;     // objects per slab
+  int use;         // PG_* use of the slab pages
+  struct spinlock lock;
+  struct slab *partial;  // slabs with free objects
+  struct slab *full;     // slabs with none
+  int nslab;
+  int ninuse;      // objects out of the slabs (incl. magazines)
+  struct magazine mag[NCPU];
+};
+
+static struct {
+  struct slabcache cache[NSLABCACHE];
+  int n;
+} slabs;
+
+// Create a cache of objects of the given size, whose
+// pages kmemstat() will count as use (PG_*).
+// Called during boot, before the other CPUs start.
+struct slabcache*
+slabcreate(char *name, uint size, int use)
+{
+  struct slabcache *sc;
+
+  size = (size + 7) & ~7;
+  if(size > PGSIZE - SLABHDR || slabs.n == NSLABCACHE)
+    panic("slabcreate");
+  sc = &slabs.cache[slabs.n++];
+  sc->name = name;
+  sc->size = size;
+  sc->perslab = (PGSIZE - SLABHDR) / size;
+  sc->use = use;
+  initlock(&sc->lock, name);
+  return sc;
+}
+
+static void
+slablink(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(s->next)
+    s->next->prev = s;
+  *list = s;
+}
+
+static void
+slabunlink(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Add a fresh slab to sc->partial.
+// Caller must hold sc->lock.
+static struct slab*
+slabgrow(struct slabcache *sc)
+{
+  struct slab *s;
+  char *p;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  kuse((char*)s, sc->use);
+  s->sc = sc;
+  s->inuse = 0;
+  s->freelist = 0;
+  p = (char*)s + SLABHDR;
+  for(i = sc->perslab - 1; i >= 0; i--){
+    *(void**)(p + i*sc->size) = s->freelist;
+    s->freelist = p + i*sc->size;
+  }
+  slablink(&sc->partial, s);
+  sc->nslab++;
+  return s;
+}
+
+// Move up to MAGBATCH objects from the slabs into m.
+static void
+slabfill(struct slabcache *sc, struct magazine *m)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&sc->lock);
+  while(m->n < MAGBATCH){
+    if((s = sc->partial) == 0 && (s = slabgrow(sc)) == 0)
+      break;
+    obj = s->freelist;
+    s->freelist = *(void**)obj;
+    s->inuse++;
+    sc->ninuse++;
+    if(s->freelist == 0){
+      slabunlink(&sc->partial, s);
+      slablink(&sc->full, s);
+    }
+    m->obj[m->n++] = obj;
+  }
+  release(&sc->lock);
+}
+
+// Return MAGBATCH objects from m to their slabs.
+// A slab that becomes empty goes back to kalloc unless
+// it is the cache's only partial slab.
+static void
+slabflush(struct slabcache *sc, struct magazine *m)
+{
+  struct slab *s;
+  void *obj;
+  int i;
+
+  acquire(&sc->lock);
+  for(i = 0; i < MAGBATCH && m->n > 0; i++){
+    obj = m->obj[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    if(s->freelist == 0){
+      slabunlink(&sc->full, s);
+      slablink(&sc->partial, s);
+    }
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+    s->inuse--;
+    sc->ninuse--;
+    if(s->inuse == 0 && (s->prev || s->next)){
+      slabunlink(&sc->partial, s);
+      sc->nslab--;
+      kfree((char*)s);
+    }
+  }
+  release(&sc->lock);
+}
+
+// Allocate one object from sc.
+// Returns 0 if the memory cannot be allocated.
+void*
+slaballoc(struct slabcache *sc)
+{
+  struct magazine *m;
+  void *obj;
+
+  pushcli();
+  m = &sc->mag[cpuid()];
+  if(m->n == 0)
+    slabfill(sc, m);
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  popcli();
+  return obj;
+}
+
+// Free an object returned by slaballoc(sc).
+void
+slabfree(struct slabcache *sc, void *obj)
+{
+  struct magazine *m;
+
+  if(((struct slab*)PGROUNDDOWN((uint)obj))->sc != sc)
+    panic("slabfree");
+  pushcli();
+  m = &sc->mag[cpuid()];
+  if(m->n == MAGSIZE)
+    slabflush(sc, m);
+  m->obj[m->n++] = obj;
+  popcli();
+}
+
+// Give sc's empty slabs back to kalloc because memory is short,
+// after returning the objects in this CPU's magazine to their
+// slabs.  (Other CPUs' magazines are theirs alone to touch.)
+// Returns the number of pages freed.
+int
+slabreap(struct slabcache *sc)
+{
+  struct magazine *m;
+  struct slab *s, *next;
+  int n;
+
+  pushcli();
+  m = &sc->mag[cpuid()];
+  while(m->n > 0)
+    slabflush(sc, m);
+  popcli();
+
+  n = 0;
+  acquire(&sc->lock);
+  for(s = sc->partial; s; s = next){
+    next = s->next;
+    if(s->inuse == 0){
+      slabunlink(&sc->partial, s);
+      sc->nslab--;
+      kfree((char*)s);
+      n++;
+    }
+  }
+  release(&sc->lock);
+  return n;
+}
+
+// Print slab cache usage to the console.
+// Runs when user types ^F on console.
+// No lock, like procdump().
+void
+slabdump(void)
+{
+  struct slabcache *sc;
+
+  for(sc = slabs.cache; sc < &slabs.cache[slabs.n]; sc++)
+    cprintf("slab %s: size %d, %d slabs, %d/%d objects in use\n",
+            sc->name, sc->size, sc->nslab, sc->ninuse,
+            sc->nslab * sc->perslab);
+}
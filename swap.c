@@ -0,0 +1,179 @@
+// Swap space for user memory.
+//
+// When kalloc() runs dry, ukalloc() makes room by shrinking the
+// buffer and inode caches or, failing that, by paging out a cold
+// user page.  swapvictim() (proc.c) runs a clock scan over the
+// pages of processes that are neither running nor inside a
+// system call, and swapout() writes the page it picks to a free
+// slot of the swap area: up to NSWAPSLOT pages, as many as fit
+// on device SWAPDEV from block SWAPSTART.  The page's PTE is
+// left not present, with PTE_SWAP set and the slot number in
+// place of the physical address; a later fault on it reads the
+// page back (see pagefault() in vm.c).
+//
+// After fork() several PTEs can name the same slot, so each slot
+// has a reference count, protected by swap.lock.  swap.iolock
+// serializes all swap I/O, so a page being written out can't be
+// read back before the write is done.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "memstat.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)  // disk blocks per slot
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSWAPSLOT];  // PTEs naming each slot
+  int present;           // swap device exists
+  uint nslot;            // slots that fit on it
+  struct sleeplock iolock;
+  struct buf buf;        // for swap I/O, under iolock
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  initsleeplock(&swap.buf.lock, "swapbuf");
+  swap.buf.data = swap.buf.block;
+  swap.present = idepresent(SWAPDEV);
+  if(swap.present && idesize(SWAPDEV) > SWAPSTART)
+    swap.nslot = (idesize(SWAPDEV) - SWAPSTART) / SLOTBLOCKS;
+  if(swap.nslot > NSWAPSLOT)
+    swap.nslot = NSWAPSLOT;
+}
+
+// Read or write the page at kernel address mem from or to slot.
+// Caller must hold swap.iolock.
+static void
+swaprw(uint slot, char *mem, int write)
+{
+  struct buf *b;
+  int i;
+
+  b = &swap.buf;
+  acquiresleep(&b->lock);
+  for(i = 0; i < SLOTBLOCKS; i++){
+    b->dev = SWAPDEV;
+    b->blockno = SWAPSTART + slot*SLOTBLOCKS + i;
+    if(write){
+      memmove(b->data, mem + i*BSIZE, BSIZE);
+      b->flags = B_DIRTY;
+    } else
+      b->flags = 0;
+    iderw(b);
+    if(!write)
+      memmove(mem + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&b->lock);
+}
+
+// Page out one user page and free it.
+// Returns -1 if there is no free slot or no page to evict.
+int
+swapout(void)
+{
+  char *mem;
+  uint slot;
+
+  if(!swap.present)
+    return -1;
+  acquiresleep(&swap.iolock);
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++)
+    if(swap.ref[slot] == 0)
+      break;
+  if(slot == swap.nslot){
+    release(&swap.lock);
+    releasesleep(&swap.iolock);
+    return -1;
+  }
+  swap.ref[slot] = 1;
+  release(&swap.lock);
+
+  if((mem = swapvictim(slot)) == 0){
+    swapfree(slot);
+    releasesleep(&swap.iolock);
+    return -1;
+  }
+  // The page is unmapped, so it is ours to write out and free.
+  swaprw(slot, mem, 1);
+  releasesleep(&swap.iolock);
+  kfree(mem);
+  return 0;
+}
+
+// Read the page in slot into the page at kernel address mem.
+void
+swapread(uint slot, char *mem)
+{
+  acquiresleep(&swap.iolock);
+  swaprw(slot, mem, 0);
+  releasesleep(&swap.iolock);
+}
+
+// Another PTE now names slot.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= NSWAPSLOT || swap.ref[slot] == 0 || swap.ref[slot] == 255)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE naming slot is gone.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= NSWAPSLOT || swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Allocate a page for user memory, paging out other user
+// pages if memory is short.  Returns 0 if that fails too.
+char*
+ukalloc(void)
+{
+  char *mem;
+  int locked;
+
+  // Paging out sleeps, so it is no help to a caller holding
+  // a spin-lock (the kernel writing to user memory in pipewrite(),
+  // say, and taking a copy-on-write fault).
+  pushcli();
+  locked = mycpu()->ncli > 1;
+  popcli();
+
+  while((mem = kalloc()) == 0)
+    if(locked || (bshrink() == 0 && ishrink() == 0 && swapout() < 0))
+      return 0;
+  kuse(mem, PG_USER);
+  return mem;
+}
+
+// Like ukalloc(), but the page is zeroed.
+char*
+ukzalloc(void)
+{
+  char *mem;
+
+  if((mem = kzalloc()) != 0)
+    kuse(mem, PG_USER);
+  else if((mem = ukalloc()) != 0)
+    memset(mem, 0, PGSIZE);
+  return mem;
+}
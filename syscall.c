@@ -54,9 +54,10 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space.  Set write if the
+// kernel will write the memory.
 int
-argptr(int n, char **pp, int size)
+argptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
@@ -65,6 +66,12 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  // The caller may use the memory while holding a spin-lock,
+  // so it must not fault then, to swap it in or to copy a
+  // copy-on-write page it writes.  It can't be paged out again
+  // while we are in a system call.
+  if(pagein(curproc->pgdir, i, size, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -109,6 +116,10 @@ extern int sys_getppid(void);
 extern int sys_changePriority(void);
 extern int sys_waitForChild(void);
 extern int sys_updateTime(void);
+extern int sys_madvise(void);
+extern int sys_memstat(void);
+extern int sys_procmem(void);
+extern int sys_iostat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]          sys_fork,
@@ -138,6 +149,10 @@ static int (*syscalls[])(void) = {
 [SYS_changePriority] sys_changePriority,
 [SYS_waitForChild]  sys_waitForChild,
 [SYS_updateTime]    sys_updateTime,
+[SYS_madvise]       sys_madvise,
+[SYS_memstat]       sys_memstat,
+[SYS_procmem]       sys_procmem,
+[SYS_iostat]        sys_iostat,
 
 };
 
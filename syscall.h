@@ -25,4 +25,8 @@
 #define SYS_getppid  24
 #define SYS_changePriority 25
 #define SYS_waitForChild 26
-#define SYS_updateTime 27
\ No newline at end of file
+#define SYS_updateTime 27
+#define SYS_madvise 28
+#define SYS_memstat 29
+#define SYS_procmem 30
+#define SYS_iostat 31
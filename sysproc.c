@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "mman.h"
+#include "memstat.h"
+#include "iostat.h"
 
 int
 sys_fork(void)
@@ -56,6 +59,52 @@ sys_sbrk(void)
   return addr;
 }
 
+// Give the pages of [addr, addr+len) back to the kernel.
+// The range stays part of the address space and reads as
+// zeros when next touched.
+int
+sys_madvise(void)
+{
+  int addr, len, advice;
+  struct proc *curproc = myproc();
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  if(advice != MADV_DONTNEED)
+    return -1;
+  if((uint)addr % PGSIZE != 0 || len < 0 ||
+     (uint)addr + len < (uint)addr ||
+     (uint)addr + PGROUNDUP(len) > PGROUNDUP(curproc->sz))
+    return -1;
+  if(discarduvm(curproc->pgdir, addr, PGROUNDUP(len)) < 0)
+    return -1;
+  switchuvm(curproc);  // flush the TLB
+  return 0;
+}
+
+int
+sys_memstat(void)
+{
+  int addr;
+  struct memstat st;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  kmemstat(&st);
+  bstat(&st);
+  return copyout(myproc()->pgdir, addr, &st, sizeof(st));
+}
+
+int
+sys_procmem(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+    return -1;
+  return procmem(addr, n);
+}
+
 int
 sys_sleep(void)
 {
@@ -123,4 +172,16 @@ sys_updateTime(void)
 {
     updateTime();
     return 1;
-}
\ No newline at end of file
+}
+
+int
+sys_iostat(void)
+{
+  int addr;
+  struct iostat st;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  idestat(&st);
+  return copyout(myproc()->pgdir, addr, &st, sizeof(st));
+}
@@ -0,0 +1,190 @@
+// Cache of loaded program segments.
+//
+// When a binary is exec()ed again while its segments are still
+// cached, exec() maps the cached physical pages into the new
+// process copy-on-write instead of reading the file again, so
+// every process running, say, sh shares one copy of its text.
+// A process that writes to one of those pages (its data, say)
+// gets a private copy in cowfault().
+//
+// An entry holds the file contents of one ELF segment, keyed by
+// inode and the segment's file offset and size.  The cache holds
+// one reference to each page, and each process that maps a page
+// holds another (see kdup()).
+//
+// Entries are loaded and looked up with the inode locked, and
+// writei()/itrunc() drop an inode's entries, also with the inode
+// locked, so the inode's sleep-lock serializes everything for a
+// given binary.  textcache.lock protects the slots themselves.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "memstat.h"
+
+struct text {
+  uint dev;
+  uint inum;      // 0 if slot is free
+  uint off;       // segment's offset in the file
+  uint filesz;    // segment's size in the file
+  int npage;
+  char **pages;   // page holding the npage page pointers
+  int busy;       // exec()s between textget() and textmap()
+  uint used;      // textcache.clock at last use
+};
+
+struct {
+  struct spinlock lock;
+  struct text text[NTEXT];
+  uint clock;
+} textcache;
+
+void
+textinit(void)
+{
+  initlock(&textcache.lock, "textcache");
+}
+
+static void
+textfree(char **pages, int npage)
+{
+  int i;
+
+  for(i = 0; i < npage; i++)
+    kfree(pages[i]);
+  kfree((char*)pages);
+}
+
+// Return the entry holding the segment [off, off+filesz) of ip,
+// reading it in on a miss and recycling the least recently used
+// idle entry.  Returns 0 if the segment can't be cached.
+// Caller must hold ip->lock and pass the entry to textmap().
+struct text*
+textget(struct inode *ip, uint off, uint filesz)
+{
+  struct text *t, *victim;
+  char **pages, *mem;
+  int n, npage;
+  uint m;
+
+  n = PGROUNDUP(filesz) / PGSIZE;
+  if(n == 0 || n > PGSIZE / sizeof(char*))
+    return 0;
+
+  acquire(&textcache.lock);
+  victim = 0;
+  for(t = textcache.text; t < &textcache.text[NTEXT]; t++){
+    if(t->inum == ip->inum && t->dev == ip->dev &&
+       t->off == off && t->filesz == filesz){
+      t->busy++;
+      t->used = ++textcache.clock;
+      release(&textcache.lock);
+      return t;
+    }
+    if(t->busy)
+      continue;
+    if(victim == 0 || t->inum == 0 ||
+       (victim->inum != 0 && t->used < victim->used))
+      victim = t;
+  }
+  if((t = victim) == 0){
+    release(&textcache.lock);
+    return 0;
+  }
+  pages = t->pages;
+  npage = t->npage;
+  t->dev = ip->dev;
+  t->inum = ip->inum;
+  t->off = off;
+  t->filesz = filesz;
+  t->npage = 0;
+  t->pages = 0;
+  t->busy = 1;
+  t->used = ++textcache.clock;
+  release(&textcache.lock);
+  if(pages)
+    textfree(pages, npage);
+
+  // No one else looks at t until ip is unlocked.
+  if((t->pages = (char**)kalloc()) == 0)
+    goto bad;
+  kuse((char*)t->pages, PG_TEXT);
+  for(; t->npage < n; t->npage++){
+    if((mem = kalloc()) == 0)
+      goto bad;
+    kuse(mem, PG_TEXT);
+    t->pages[t->npage] = mem;
+    m = filesz - t->npage*PGSIZE;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if(readi(ip, mem, off + t->npage*PGSIZE, m) != m){
+      t->npage++;
+      goto bad;
+    }
+    if(m < PGSIZE)
+      memset(mem + m, 0, PGSIZE - m);
+  }
+  return t;
+
+bad:
+  acquire(&textcache.lock);
+  pages = t->pages;
+  npage = t->npage;
+  t->inum = 0;
+  t->npage = 0;
+  t->pages = 0;
+  t->busy = 0;
+  release(&textcache.lock);
+  if(pages)
+    textfree(pages, npage);
+  return 0;
+}
+
+// Map the pages of t at user address va in pgdir,
+// copy-on-write, and release t.
+int
+textmap(pde_t *pgdir, struct text *t, uint va)
+{
+  int i, r;
+
+  r = 0;
+  for(i = 0; i < t->npage; i++)
+    if((r = mapcow(pgdir, va + i*PGSIZE, t->pages[i])) < 0)
+      break;
+  acquire(&textcache.lock);
+  t->busy--;
+  release(&textcache.lock);
+  return r;
+}
+
+// Drop the cached segments of ip, whose contents are changing.
+// Processes already running them keep their pages.
+// Caller must hold ip->lock.
+void
+textinval(struct inode *ip)
+{
+  struct text *t;
+  char **pages;
+  int npage;
+
+  for(t = textcache.text; t < &textcache.text[NTEXT]; t++){
+    acquire(&textcache.lock);
+    pages = 0;
+    npage = 0;
+    if(t->inum == ip->inum && t->dev == ip->dev){
+      pages = t->pages;
+      npage = t->npage;
+      t->inum = 0;
+      t->npage = 0;
+      t->pages = 0;
+    }
+    release(&textcache.lock);
+    if(pages)
+      textfree(pages, npage);
+  }
+}
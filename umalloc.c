@@ -2,9 +2,17 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mman.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+//
+// free() also gives large free blocks back to the kernel: the
+// heap shrinks with sbrk() when the block is at its top, and
+// the pages inside other blocks are dropped with madvise().
+
+#define PAGE     4096
+#define RELEASE  (16*PAGE)  // free space worth giving back
 
 typedef long Align;
 
@@ -21,12 +29,13 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// Put block bp on the free list, merging it with its
+// neighbours.  Returns the free block that now holds it.
+static Header*
+insert(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -35,12 +44,39 @@ free(void *ap)
     bp->s.ptr = p->s.ptr->s.ptr;
   } else
     bp->s.ptr = p->s.ptr;
+  freep = p;
   if(p + p->s.size == bp){
     p->s.size += bp->s.size;
     p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+    return p;
+  }
+  p->s.ptr = bp;
+  return bp;
+}
+
+// Give the whole pages of free block bp back to the kernel,
+// if there are enough of them.  The block keeps its header.
+static void
+release(Header *bp)
+{
+  char *start, *end;
+
+  start = (char*)(((uint)(bp + 1) + PAGE - 1) & ~(PAGE - 1));
+  end = (char*)(bp + bp->s.size);
+  if(end == sbrk(0)){
+    if(end - start >= RELEASE && sbrk(-(end - start)) != (char*)-1)
+      bp->s.size = (Header*)start - bp;
+    return;
+  }
+  end = (char*)((uint)end & ~(PAGE - 1));
+  if(end > start && end - start >= RELEASE)
+    madvise(start, end - start, MADV_DONTNEED);
+}
+
+void
+free(void *ap)
+{
+  release(insert((Header*)ap - 1));
 }
 
 static Header*
@@ -56,7 +92,7 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  insert(hp);
   return freep;
 }
 
@@ -1,6 +1,9 @@
 struct stat;
 struct rtcdate;
 struct timeStruct;
+struct memstat;
+struct procmem;
+struct iostat;
 
 // system calls
 int fork(void);
@@ -29,6 +32,10 @@ int changePolicy(int schedule_type);
 int changePriority(int newPriority);
 int waitForChild(struct timeStruct *time);
 int updateTime(void);
+int madvise(void*, uint, int);
+int memstat(struct memstat*);
+int procmem(struct procmem*, int);
+int iostat(struct iostat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
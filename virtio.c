@@ -0,0 +1,268 @@
+// Driver for a virtio block device (the legacy PCI interface,
+// as QEMU's -drive if=virtio provides), used in place of IDE
+// disk 1 when there is one.  ide.c hands it the requests.
+//
+// The driver and the device share a virtqueue: a table of
+// descriptors, each naming a piece of memory, an avail ring in
+// which the driver passes chains of descriptors to the device,
+// and a used ring in which the device passes them back before
+// interrupting.  Each request is a chain of three descriptors
+// (header, the buf's data, status byte), so up to a third of
+// the queue size requests can be outstanding at once.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "iostat.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define NDESC  256  // most descriptors used
+
+struct virtioreq {
+  struct virtio_blk_req hdr;
+  struct buf *b;
+  uchar status;
+};
+
+static struct {
+  struct spinlock lock;
+  ushort base;            // I/O port of the registers, 0 if no device
+  int irq;
+  uint64 nsector;         // capacity
+  int qsize;              // descriptors in the queue
+  int ndesc;              // ... that are used
+  struct virtq_desc *desc;
+  struct virtq_avail *avail;
+  struct virtq_used *used;
+  ushort usedidx;         // next used entry to look at
+  uchar free[NDESC];      // is descriptor free?
+  int nfree;
+  struct virtioreq req[NDESC];  // by first descriptor of the chain
+  struct iostat stats;
+} vdisk;
+
+void
+virtioinit(void)
+{
+  struct pcidev pci;
+  char *mem;
+  uint sz, used;
+  int i, order;
+
+  initlock(&vdisk.lock, "virtio");
+  if(!pcidevice(VIRTIO_VENDOR, VIRTIO_BLK, &pci) || !(pciread(&pci, PCI_BAR0) & 1))
+    return;
+  vdisk.base = pci.bar[0];
+
+  outb(vdisk.base + VIRTIO_STATUS, 0);  // reset
+  outb(vdisk.base + VIRTIO_STATUS, VIRTIO_ST_ACK);
+  outb(vdisk.base + VIRTIO_STATUS, VIRTIO_ST_ACK | VIRTIO_ST_DRIVER);
+  outl(vdisk.base + VIRTIO_GFEATURES, 0);  // no optional features
+
+  // The device decides the queue size; the driver allocates
+  // physically contiguous memory for it and the rings.
+  outw(vdisk.base + VIRTIO_QSEL, 0);
+  vdisk.qsize = inw(vdisk.base + VIRTIO_QSIZE);
+  used = (vdisk.qsize*(sizeof(struct virtq_desc) + sizeof(ushort)) +
+          2*sizeof(ushort) + VIRTQ_ALIGN-1) & ~(VIRTQ_ALIGN-1);
+  sz = used + 2*sizeof(ushort) + vdisk.qsize*sizeof(struct virtq_used_elem);
+  for(order = 0; (PGSIZE << order) < sz; order++)
+    ;
+  if(vdisk.qsize < 3 || (mem = kallocpages(order)) == 0){
+    outb(vdisk.base + VIRTIO_STATUS, VIRTIO_ST_FAILED);
+    vdisk.base = 0;
+    return;
+  }
+  memset(mem, 0, PGSIZE << order);
+  vdisk.desc = (struct virtq_desc*)mem;
+  vdisk.avail = (struct virtq_avail*)(mem + vdisk.qsize*sizeof(struct virtq_desc));
+  vdisk.used = (struct virtq_used*)(mem + used);
+  vdisk.ndesc = vdisk.qsize < NDESC ? vdisk.qsize : NDESC;
+  for(i = 0; i < vdisk.ndesc; i++)
+    vdisk.free[i] = 1;
+  vdisk.nfree = vdisk.ndesc;
+  outl(vdisk.base + VIRTIO_QPFN, V2P(mem) / PGSIZE);
+
+  vdisk.nsector = inl(vdisk.base + VIRTIO_CONFIG) |
+                  (uint64)inl(vdisk.base + VIRTIO_CONFIG + 4) << 32;
+  vdisk.irq = pci.irq;
+  ioapicenable(vdisk.irq, ncpu - 1);
+  outb(vdisk.base + VIRTIO_STATUS,
+       VIRTIO_ST_ACK | VIRTIO_ST_DRIVER | VIRTIO_ST_DRIVER_OK);
+  cprintf("virtio: disk %d, %d sectors, queue of %d\n",
+          ROOTDEV, (uint)vdisk.nsector, vdisk.qsize);
+}
+
+// Does the virtio disk serve device dev?
+int
+virtiodisk(int dev)
+{
+  return vdisk.base != 0 && dev == ROOTDEV;
+}
+
+// Blocks on the virtio disk.
+uint
+virtiosize(void)
+{
+  uint64 n;
+
+  n = vdisk.nsector / (BSIZE/512);
+  return n > 0xffffffff ? 0xffffffff : n;
+}
+
+// Take a free descriptor.  Caller must hold vdisk.lock
+// and have checked vdisk.nfree.
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vdisk.ndesc; i++)
+    if(vdisk.free[i]){
+      vdisk.free[i] = 0;
+      vdisk.nfree--;
+      return i;
+    }
+  panic("virtio: no free descriptor");
+}
+
+// Free the chain of descriptors starting at i.
+static void
+freechain(int i)
+{
+  for(;;){
+    vdisk.free[i] = 1;
+    vdisk.nfree++;
+    if(!(vdisk.desc[i].flags & VIRTQ_DESC_NEXT))
+      break;
+    i = vdisk.desc[i].next;
+  }
+  wakeup(&vdisk.free);
+}
+
+static void
+setdesc(int i, void *p, uint len, int flags, int next)
+{
+  vdisk.desc[i].addr = V2P(p);
+  vdisk.desc[i].len = len;
+  vdisk.desc[i].flags = flags;
+  vdisk.desc[i].next = next;
+}
+
+// Queue buf for the disk and return without waiting,
+// like iderwstart().
+void
+virtiorwstart(struct buf *b)
+{
+  struct virtioreq *r;
+  int d[3], i, write;
+
+  if((uint64)b->blockno * (BSIZE/512) >= vdisk.nsector)
+    panic("virtio: block out of range");
+  write = (b->flags & B_DIRTY) != 0;
+
+  acquire(&vdisk.lock);
+  b->flags |= B_QUEUED;
+  while(vdisk.nfree < 3)
+    sleep(&vdisk.free, &vdisk.lock);
+  for(i = 0; i < 3; i++)
+    d[i] = allocdesc();
+
+  r = &vdisk.req[d[0]];
+  r->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  r->hdr.reserved = 0;
+  r->hdr.sector = (uint64)b->blockno * (BSIZE/512);
+  r->b = b;
+  r->status = 0xff;  // device writes 0 on success
+  setdesc(d[0], &r->hdr, sizeof(r->hdr), VIRTQ_DESC_NEXT, d[1]);
+  setdesc(d[1], b->data, BSIZE,
+          (write ? 0 : VIRTQ_DESC_WRITE) | VIRTQ_DESC_NEXT, d[2]);
+  setdesc(d[2], &r->status, 1, VIRTQ_DESC_WRITE, 0);
+
+  // The device must see the descriptors before the ring
+  // entry, and the entry before the new index.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.qsize] = d[0];
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  if(!(vdisk.used->flags & VIRTQ_USED_NO_NOTIFY))
+    outw(vdisk.base + VIRTIO_QNOTIFY, 0);
+
+  vdisk.stats.nreq++;
+  vdisk.stats.ncmd++;
+  if(++vdisk.stats.depth > vdisk.stats.maxdepth)
+    vdisk.stats.maxdepth = vdisk.stats.depth;
+  release(&vdisk.lock);
+}
+
+// Wait for the request for buf, if any, to finish.
+void
+virtiorwwait(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while(b->flags & B_QUEUED)
+    sleep(b, &vdisk.lock);
+  release(&vdisk.lock);
+}
+
+// Interrupt handler.  Returns 0 if irq is not the disk's.
+int
+virtiointr(int irq)
+{
+  struct virtioreq *r;
+  struct buf *b;
+  int id;
+
+  if(vdisk.base == 0 || irq != vdisk.irq)
+    return 0;
+
+  acquire(&vdisk.lock);
+  inb(vdisk.base + VIRTIO_ISR);  // acknowledge
+
+  while(vdisk.usedidx != *(volatile ushort*)&vdisk.used->idx){
+    __sync_synchronize();
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.qsize].id;
+    r = &vdisk.req[id];
+    if(r->status != 0)
+      panic("virtio: request failed");
+    b = r->b;
+    freechain(id);
+    vdisk.usedidx++;
+    vdisk.stats.depth--;
+
+    // Wake process waiting for this buf,
+    // or release it if no process is.
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_QUEUED);
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bdone(b);
+    } else
+      wakeup(b);
+  }
+
+  release(&vdisk.lock);
+  return 1;
+}
+
+// Add the request counters to st.
+void
+virtiostat(struct iostat *st)
+{
+  acquire(&vdisk.lock);
+  st->nreq += vdisk.stats.nreq;
+  st->ncmd += vdisk.stats.ncmd;
+  st->depth += vdisk.stats.depth;
+  if(vdisk.stats.maxdepth > st->maxdepth)
+    st->maxdepth = vdisk.stats.maxdepth;
+  release(&vdisk.lock);
+}
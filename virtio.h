@@ -0,0 +1,62 @@
+// Virtio devices, legacy PCI interface.
+
+#define VIRTIO_VENDOR     0x1af4
+#define VIRTIO_BLK        0x1001  // legacy block device ID
+
+// Registers, at the I/O port in BAR0.
+#define VIRTIO_FEATURES   0x00  // device features
+#define VIRTIO_GFEATURES  0x04  // features the driver uses
+#define VIRTIO_QPFN       0x08  // page number of the selected queue
+#define VIRTIO_QSIZE      0x0c  // size of the selected queue
+#define VIRTIO_QSEL       0x0e  // queue select
+#define VIRTIO_QNOTIFY    0x10  // queue notify
+#define VIRTIO_STATUS     0x12  // device status
+#define VIRTIO_ISR        0x13  // interrupt status, cleared by reading
+#define VIRTIO_CONFIG     0x14  // device-specific configuration
+
+// VIRTIO_STATUS bits
+#define VIRTIO_ST_ACK       0x01  // driver found the device
+#define VIRTIO_ST_DRIVER    0x02  // driver knows how to drive it
+#define VIRTIO_ST_DRIVER_OK 0x04  // driver is ready
+#define VIRTIO_ST_FAILED    0x80
+
+#define VIRTQ_ALIGN  4096  // the used ring starts on a page
+
+// Virtqueue descriptor: one piece of a request.
+struct virtq_desc {
+  uint64 addr;    // physical address
+  uint len;
+  ushort flags;
+  ushort next;    // next descriptor of the chain, if VIRTQ_DESC_NEXT
+};
+#define VIRTQ_DESC_NEXT   1  // chained with next
+#define VIRTQ_DESC_WRITE  2  // device writes the memory
+
+// Requests the driver has made available.
+struct virtq_avail {
+  ushort flags;
+  ushort idx;     // where the driver puts the next entry
+  ushort ring[];  // first descriptors of the chains
+};
+
+// Requests the device is done with.
+struct virtq_used_elem {
+  uint id;        // first descriptor of the chain
+  uint len;
+};
+
+struct virtq_used {
+  ushort flags;
+  ushort idx;     // where the device puts the next entry
+  struct virtq_used_elem ring[];
+};
+#define VIRTQ_USED_NO_NOTIFY  1  // device doesn't need QNOTIFY
+
+// Block request header, followed by the data and a status byte.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+#define VIRTIO_BLK_T_IN   0  // read
+#define VIRTIO_BLK_T_OUT  1  // write
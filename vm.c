@@ -6,10 +6,13 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "memstat.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+#define SPGORDER 10  // kallocpages() order of a SPGSIZE superpage
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -39,13 +42,15 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    panic("walkpgdir: superpage");
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
+    kuse((char*)pgtab, PG_PGTBL);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -54,6 +59,44 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   return &pgtab[PTX(va)];
 }
 
+// Return the PTE that maps va in pgdir, or 0 if there is no
+// page table for va.  For an address inside a 4MB superpage,
+// make up the 4KB PTE it would have in a page table.
+static pte_t
+lookuppte(pde_t *pgdir, const void *va)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return (PTE_ADDR(*pde) + ((uint)va & (SPGSIZE-1) & ~(PGSIZE-1))) |
+           (PTE_FLAGS(*pde) & ~PTE_PS);
+  if((pte = walkpgdir(pgdir, va, 0)) == 0)
+    return 0;
+  return *pte;
+}
+
+// Replace the superpage entry *pde by a page table that maps
+// the same 4MB with 4KB pages, so they can be freed one by one.
+static int
+splitpde(pde_t *pde)
+{
+  pte_t *pgtab;
+  uint pa, flags;
+  int i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  kuse((char*)pgtab, PG_PGTBL);
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | flags;
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
@@ -85,6 +128,10 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
+// The kernel half of every page directory points at the same
+// page-table pages, built once in kpgdir by kvmalloc(); setupkvm()
+// just copies those directory entries and freevm() leaves them.
+//
 // setupkvm() and exec() set up every page table like this:
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
@@ -119,28 +166,32 @@ pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  kuse((char*)pgdir, PG_PGTBL);
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel page-table pages are
+// shared by every other page table.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kzalloc()) == 0)
+    panic("kvmalloc");
+  kuse((char*)kpgdir, PG_PGTBL);
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mappages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -186,8 +237,8 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
+  kuse(mem, PG_USER);
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -198,14 +249,14 @@ int
 loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 {
   uint i, pa, n;
-  pte_t *pte;
+  pte_t pte;
 
   if((uint) addr % PGSIZE != 0)
     panic("loaduvm: addr must be page aligned");
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
+    if((pte = lookuppte(pgdir, addr+i)) == 0)
       panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
+    pa = PTE_ADDR(pte);
     if(sz - i < PGSIZE)
       n = sz - i;
     else
@@ -218,11 +269,14 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Aligned 4MB stretches are mapped with a single superpage when a
+// 4MB block is free, saving the page table and most TLB entries.
 int
 allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   char *mem;
   uint a;
+  pde_t *pde;
 
   if(newsz >= KERNBASE)
     return 0;
@@ -231,13 +285,26 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    pde = &pgdir[PDX(a)];
+    if(*pde & PTE_PS){
+      // Still mapped: deallocuvm() could not split this superpage.
+      memset(P2V(PTE_ADDR(*pde)) + (a & (SPGSIZE-1)), 0, PGSIZE);
+      continue;
+    }
+    if(a % SPGSIZE == 0 && newsz - a >= SPGSIZE && !(*pde & PTE_P) &&
+       (mem = kallocpages(SPGORDER)) != 0){
+      kusepages(mem, SPGORDER, PG_USER);
+      memset(mem, 0, SPGSIZE);
+      *pde = V2P(mem) | PTE_PS | PTE_P | PTE_W | PTE_U;
+      a += SPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = ukzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -256,6 +323,7 @@ int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   pte_t *pte;
+  pde_t *pde;
   uint a, pa;
 
   if(newsz >= oldsz)
@@ -263,6 +331,18 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if((*pde & PTE_PS) && a % SPGSIZE == 0){
+      kfreepages(P2V(PTE_ADDR(*pde)), SPGORDER);
+      *pde = 0;
+      a += SPGSIZE - PGSIZE;
+      continue;
+    }
+    if((*pde & PTE_PS) && splitpde(pde) < 0){
+      // Out of memory: leave the superpage mapped.
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -273,13 +353,17 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
-    }
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_SLOT(*pte));
+      *pte = 0;
+    } else if(*pte & PTE_ZERO)
+      *pte = 0;
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part is shared and stays.
 void
 freevm(pde_t *pgdir)
 {
@@ -288,7 +372,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -311,25 +395,61 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child: memory below sz, plus whatever is
+// mapped from ULIBBASE up (the runtime library).
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
-  pde_t *d;
-  pte_t *pte;
+  pde_t *d, *pde;
+  pte_t pte, *dpte;
   uint pa, i, flags;
   char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
+  for(i = 0; i < KERNBASE; i += PGSIZE){
+    if(i >= sz && i < ULIBBASE)
+      i = ULIBBASE;
+    pde = &pgdir[PDX(i)];
+    if(i >= ULIBBASE && !(*pde & PTE_P)){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pde & PTE_PS) && (mem = kallocpages(SPGORDER)) != 0){
+      kusepages(mem, SPGORDER, PG_USER);
+      memmove(mem, P2V(PTE_ADDR(*pde)), SPGSIZE);
+      d[PDX(i)] = V2P(mem) | PTE_FLAGS(*pde);
+      i += SPGSIZE - PGSIZE;
+      continue;
+    }
+    // Without a free 4MB block, a superpage is copied
+    // a page at a time, like any other.
+    pte = lookuppte(pgdir, (void *) i);
+    if(i >= ULIBBASE && !(pte & (PTE_P|PTE_SWAP|PTE_ZERO)))
+      continue;
+    if(pte == 0)
       panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
+    if(pte & (PTE_SWAP|PTE_ZERO)){
+      // Swapped out or discarded: the child's PTE says the same,
+      // naming the same swap slot.
+      if((dpte = walkpgdir(d, (void*)i, 1)) == 0)
+        goto bad;
+      if(pte & PTE_SWAP)
+        swapdup(PTE_SLOT(pte));
+      *dpte = pte;
+      continue;
+    }
+    if(!(pte & PTE_P))
       panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    pa = PTE_ADDR(pte);
+    flags = PTE_FLAGS(pte);
+    if(flags & PTE_COW){
+      // Shared program text: share it with the child too.
+      if(mapcow(d, i, P2V(pa)) < 0)
+        goto bad;
+      continue;
+    }
+    if((mem = ukalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
     if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
@@ -344,19 +464,257 @@ bad:
   return 0;
 }
 
+// Map the page at kernel address mem at user address va in
+// pgdir, read-only and copy-on-write, taking a reference to it.
+int
+mapcow(pde_t *pgdir, uint va, char *mem)
+{
+  if(mappages(pgdir, (void*)va, PGSIZE, V2P(mem), PTE_U|PTE_COW) < 0)
+    return -1;
+  kdup(mem);
+  return 0;
+}
+
+// Handle a write to copy-on-write user address va in pgdir:
+// give the process its own writable copy of the page, or just
+// make it writable if no one else maps it any more.
+// Returns -1 if va is not copy-on-write or memory is short.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem, *old;
+
+  if(va >= KERNBASE || (pgdir[PDX(va)] & (PTE_P|PTE_PS)) != PTE_P)
+    return -1;
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  old = P2V(PTE_ADDR(*pte));
+  if(krefs(old) > 1){
+    if((mem = ukalloc()) == 0)
+      return -1;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kfree(old);
+  } else
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  invlpg((void*)PGROUNDDOWN(va));
+  return 0;
+}
+
+// Give the not-present page at user address va in pgdir its
+// memory back: read it from swap, or zero-fill a discarded page.
+// Returns -1 if memory is short.
+static int
+fillpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((mem = ukalloc()) == 0)
+    return -1;
+  // Only this process changes its not-present PTEs,
+  // so *pte stays put while ukalloc() or swapread() sleep.
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(*pte & PTE_SWAP){
+    swapread(PTE_SLOT(*pte), mem);
+    swapfree(PTE_SLOT(*pte));
+  } else
+    memset(mem, 0, PGSIZE);
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~(PTE_SWAP|PTE_ZERO)) | PTE_P;
+  return 0;
+}
+
+// Handle a page fault at user address va in pgdir, from user
+// code or from the kernel touching user memory: bring the page
+// back from swap or zero-fill it, and on a write break
+// copy-on-write.
+// Returns -1 if there was nothing to do, so the fault is an error.
+int
+pagefault(pde_t *pgdir, uint va, int write)
+{
+  pte_t pte;
+  int done;
+
+  if(va >= KERNBASE)
+    return -1;
+  done = 0;
+  pte = lookuppte(pgdir, (void*)va);
+  if(pte & (PTE_SWAP|PTE_ZERO)){
+    if(fillpage(pgdir, va) < 0)
+      return -1;
+    pte = lookuppte(pgdir, (void*)va);
+    done = 1;
+  }
+  if(write && (pte & PTE_COW)){
+    if(cowfault(pgdir, va) < 0)
+      return -1;
+    done = 1;
+  }
+  return done ? 0 : -1;
+}
+
+// Make [va, va+n) ready for the kernel to use without faulting,
+// perhaps while holding a spin-lock: bring back swapped-out or
+// discarded pages and, if it will write them, break copy-on-write.
+// Returns -1 if memory is short.
+int
+pagein(pde_t *pgdir, uint va, uint n, int write)
+{
+  uint a;
+  pte_t pte;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = lookuppte(pgdir, (void*)a);
+    if(((pte & (PTE_SWAP|PTE_ZERO)) || (write && (pte & PTE_COW))) &&
+       pagefault(pgdir, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Free the physical pages behind [va, va+n) of pgdir but keep
+// the addresses valid: each PTE becomes PTE_ZERO, and the page
+// comes back zero-filled when next touched.  A copy-on-write
+// page only loses pgdir's reference; it comes back writable,
+// as cowfault() would have made it.  va and n must be
+// page-aligned.  The caller must flush the TLB.
+int
+discarduvm(pde_t *pgdir, uint va, uint n)
+{
+  pde_t *pde;
+  pte_t *pte;
+  uint a;
+
+  for(a = va; a < va + n; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if(!(*pde & PTE_P)){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pde & PTE_PS) && splitpde(pde) < 0)
+      return -1;
+    pte = walkpgdir(pgdir, (void*)a, 0);
+    if(*pte & PTE_SWAP){
+      swapfree(PTE_SLOT(*pte));
+      *pte = PTE_ZERO | (*pte & (PTE_W|PTE_U));
+    } else if((*pte & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U|PTE_COW)){
+      kfree(P2V(PTE_ADDR(*pte)));
+      *pte = PTE_ZERO | PTE_W | PTE_U;
+    } else if((*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U)){
+      kfree(P2V(PTE_ADDR(*pte)));
+      *pte = PTE_ZERO | (*pte & (PTE_W|PTE_U));
+    }
+  }
+  return 0;
+}
+
+// Clock scan for swapvictim(): look at up to *n pages of pgdir
+// from *va up to sz.  A page used since the last pass has its
+// accessed bit cleared and is passed over.  The first private,
+// resident, unused page found is unmapped, its PTE now naming
+// swap slot slot.  Returns that page's kernel address, or 0
+// when *n or sz runs out.  pgdir must not be in use on any CPU.
+char*
+swapscan(pde_t *pgdir, uint sz, uint *va, int *n, uint slot)
+{
+  pde_t *pde;
+  pte_t *pte;
+  char *v;
+  uint a;
+
+  while(*va < sz && *n > 0){
+    a = *va;
+    *va += PGSIZE;
+    (*n)--;
+    pde = &pgdir[PDX(a)];
+    if(!(*pde & PTE_P) || (*pde & PTE_PS)){
+      *va = PGADDR(PDX(a) + 1, 0, 0);
+      continue;
+    }
+    pte = (pte_t*)P2V(PTE_ADDR(*pde)) + PTX(a);
+    if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    v = P2V(PTE_ADDR(*pte));
+    if(krefs(v) > 1)
+      continue;
+    *pte = SWAPPTE(slot, *pte);
+    return v;
+  }
+  return 0;
+}
+
+// Return the number of pages of pgdir below sz that are
+// swapped out.
+int
+swapcount(pde_t *pgdir, uint sz)
+{
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = 0; a < sz; a += PGSIZE){
+    if(!(pgdir[PDX(a)] & PTE_P) || (pgdir[PDX(a)] & PTE_PS)){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(lookuppte(pgdir, (void*)a) & PTE_SWAP)
+      n++;
+  }
+  return n;
+}
+
+// Count the pages pgdir maps below KERNBASE into pm.
+// Pages are shared if someone else (another process, or the
+// text cache) holds a reference too.
+void
+uvmstat(pde_t *pgdir, struct procmem *pm)
+{
+  pte_t *pgtab;
+  uint pa;
+  int i, j;
+
+  pm->pgtbl = 1;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    if(pgdir[i] & PTE_PS){
+      pm->resident += NPTENTRIES;
+      continue;
+    }
+    pm->pgtbl++;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_SWAP)
+        pm->swapped++;
+      else if(pgtab[j] & PTE_P){
+        pm->resident++;
+        pa = PTE_ADDR(pgtab[j]);
+        if(pa < PHYSTOP && krefs(P2V(pa)) > 1)
+          pm->shared++;
+      }
+    }
+  }
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
-  pte_t *pte;
+  pte_t pte;
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  pte = lookuppte(pgdir, uva);
+  if((pte & PTE_P) == 0)
     return 0;
-  if((*pte & PTE_U) == 0)
+  if((pte & PTE_U) == 0)
     return 0;
-  return (char*)P2V(PTE_ADDR(*pte));
+  return (char*)P2V(PTE_ADDR(pte));
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
@@ -371,6 +729,9 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if((lookuppte(pgdir, (char*)va0) & (PTE_SWAP|PTE_ZERO|PTE_COW)) &&
+       pagefault(pgdir, va0, 1) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;